@@ -3,8 +3,14 @@
 #ifndef RAM_MINIMIZER_ENGINE_HPP_
 #define RAM_MINIMIZER_ENGINE_HPP_
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -17,6 +23,71 @@ namespace ram {
 
 class MinimizerEngine {
  public:
+  // scheme used to sample kmers from a sequence
+  enum class Sampling {
+    kMinimizer,      // smallest kmer in each window of w kmers
+    kOpenSyncmer,    // kmers with the smallest s-mer in their middle
+                     // (either middle offset if k - s is odd)
+    kClosedSyncmer,  // kmers with the smallest s-mer at either end
+    kModMinimizer    // kmer at (smallest t-mer position) mod w in each window
+  };
+
+  // placement of the index built by Minimize on NUMA nodes; both policies
+  // pin the workers of the thread pool round-robin to the online nodes, for
+  // good, hence also for other users of a shared pool; the constructor waits
+  // until each worker has run its pinning task, so the pool should be idle,
+  // and throws if called from one of the workers (it would never return)
+  enum class Placement {
+    kDefault,     // pages are placed by whichever worker touches them first
+    kInterleave,  // pages are spread round-robin over all nodes
+    kFirstTouch   // pages are placed on the node of the (pinned) worker
+  };
+
+  // minimizer index statistics, refreshed by Filter
+  struct Statistics {
+    std::uint64_t num_minimizers = 0;  // postings
+    std::uint64_t num_keys = 0;        // distinct minimizers
+    std::uint64_t num_singletons = 0;  // keys with a single posting
+    std::uint64_t num_bytes = 0;       // approximate memory of the index
+    std::uint32_t occurrence = -1;     // frequency threshold
+    std::vector<std::uint64_t> histogram;  // keys per [2^i, 2^(i + 1)) postings
+
+    double singleton_fraction() const {
+      return num_keys ? num_singletons / static_cast<double>(num_keys) : 0.;
+    }
+  };
+
+  // parameters of Map, MapBeginEnd and MapCoarseToFine in one place
+  struct MapOptions {
+    bool avoid_equal = false;      // ignore overlaps in which lhs_id == rhs_id
+    bool avoid_symmetric = false;  // ignore overlaps in which lhs_id > rhs_id
+    bool micromize = false;
+    double micromize_factor = 0.;
+    std::uint8_t N = 0;
+    std::uint32_t K = 0;        // if nonzero use MapBeginEnd
+    double coarse_factor = 0.;  // if nonzero use MapCoarseToFine
+  };
+
+  // receives a sequence of a batch and its overlaps once it is mapped
+  using MapCallback =
+      std::function<void(const std::unique_ptr<biosoup::Sequence>&,
+                         std::vector<biosoup::Overlap>&&)>;
+
+  // sketching, index and mapping parameters added on top of the
+  // constructor ones, see the members they are copied to
+  struct Options {
+    bool mask_ambiguous = false;  // restart sketching at non-ACGT bases
+    bool mask_lowercase = false;  // restart sketching at soft-masked bases
+    Sampling sampling = Sampling::kMinimizer;
+    std::uint32_t smer_len = 0;        // s-mer (t-mer) length, 0 = from k, w
+    std::uint32_t cache_size = 0;      // Map results kept for duplicate reads
+    std::uint32_t max_per_target = 0;  // best overlaps per target, 0 = all
+    bool skip_contained = false;       // see Map
+    double downweight_frequency = 0.;  // see Minimize
+    std::uint32_t max_postings = 0;    // see Minimize
+    Placement placement = Placement::kDefault;
+  };
+
   MinimizerEngine(
       std::uint32_t kmer_len,  // element of [1, 32]
       std::uint32_t window_len,
@@ -29,6 +100,15 @@ class MinimizerEngine {
       bool hpc = false,               // use homopolymer-compressed minimizers
       std::shared_ptr<thread_pool::ThreadPool> thread_pool = nullptr);
 
+  MinimizerEngine(
+      std::uint32_t kmer_len, std::uint32_t window_len,
+      std::uint32_t chaining_score_treshold,
+      std::uint64_t chain_enlongation_stop_criteria,
+      std::uint8_t chain_minimizer_cnt_treshold, std::uint32_t best_n,
+      std::uint32_t reduce_win_sz, bool robust_winnowing, bool hpc,
+      std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+      const Options& options);
+
   MinimizerEngine(const MinimizerEngine&) = delete;
   MinimizerEngine& operator=(const MinimizerEngine&) = delete;
 
@@ -38,15 +118,47 @@ class MinimizerEngine {
   ~MinimizerEngine() = default;
 
   // transform set of sequences to minimizer index
+  // (number of bins grows with the number of minimizers)
+  // (with downweight_frequency, kmers among that fraction of the most
+  // frequent ones in [begin, end) are chosen in a window only if it holds
+  // nothing else, in the targets and in sequences mapped afterwards, as in
+  // Winnowmap; requires minimizer sampling and k < 32, kept when appending)
+  // (with max_postings, kmers with more postings are dropped from the
+  // index, counted whenever their bin is rebuilt)
   void Minimize(
       std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator begin,
-      std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator end);
+      std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator end,
+      bool append = false);  // add to the existing index instead of replacing
 
-  // set occurrence frequency threshold
+  // set occurrence frequency threshold, collect index statistics and
+  // build a membership filter of the kmers below the threshold
   void Filter(double frequency);
 
+  // statistics of the index as of the last Filter call
+  const Statistics& Stats() const { return stats_; }
+
+  // (id, length) of the indexed targets by id, from Minimize or Attach
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> TargetLengths() const;
+
+  // write the minimizer index to a flat file which can be attached
+  void Store(const std::string& path) const;
+
+  // map an index written by Store read-only instead of building one;
+  // the pages are shared by all processes attaching the same file
+  // (place it in /dev/shm to keep it in memory only), Filter still applies;
+  // target lengths are restored as well
+  void Attach(const std::string& path);
+
   // find overlaps in preconstructed minimizer index
   // micromizers = smallest sequence->data.size() / k minimizers
+  // (with a cache, sequences identical to an already mapped one reuse its
+  // overlaps if neither avoid flag is set)
+  // (with skip_contained and avoid_equal, i.e. all-vs-all, sequences found
+  // to be contained in a longer target are flagged by id; flagged sequences
+  // map to nothing and overlaps with flagged targets are dropped; flags
+  // persist over Minimize calls so that target chunks share them and apply
+  // to MapBeginEnd and MapCoarseToFine as well; with concurrent calls the
+  // dropped overlaps depend on the order in which sequences are mapped)
   std::vector<biosoup::Overlap> Map(
       const std::unique_ptr<biosoup::Sequence>& sequence,
       bool avoid_equal,      // ignore overlaps in which lhs_id == rhs_id
@@ -62,24 +174,81 @@ class MinimizerEngine {
       bool avoid_symmetric,    // ignore overlaps in which lhs_id > rhs_id
       std::uint32_t K) const;  // only lhs
 
+  // find overlaps with a sparse sketch (micromizers scaled by coarse_factor)
+  // first; only if the result is empty or ambiguous, map again with the
+  // full sketch restricted to the targets found (all if none)
+  std::vector<biosoup::Overlap> MapCoarseToFine(
+      const std::unique_ptr<biosoup::Sequence>& sequence,
+      bool avoid_equal,      // ignore overlaps in which lhs_id == rhs_id
+      bool avoid_symmetric,  // ignore overlaps in which lhs_id > rhs_id
+      double coarse_factor) const;
+
+  // find overlaps with the strategy selected by options
+  std::vector<biosoup::Overlap> Map(
+      const std::unique_ptr<biosoup::Sequence>& sequence,
+      const MapOptions& options) const;
+
+  // estimated work of mapping sequence, its length scaled with avoid_symmetric
+  // by the share of target bases with ids not lower than its own (the
+  // triangle of all-vs-all mapping), used to start expensive sequences first
+  double MapCost(const std::unique_ptr<biosoup::Sequence>& sequence,
+                 const MapOptions& options) const;
+
+  // map [begin, end) on the thread pool, most expensive first, and pass
+  // the overlaps of each sequence to callback as soon as it is mapped;
+  // callback runs on the workers (concurrently with more than one thread),
+  // so a slow callback holds back mapping and at most one sequence per
+  // thread is in flight; the returned future is ready after the last
+  // callback and rethrows the first exception (remaining sequences are
+  // then skipped); the workers use the engine, the vector of [begin, end)
+  // and its sequences until then, hence all of them have to outlive the
+  // future (wait on it before destroying or modifying any of them)
+  std::future<void> MapBatch(
+      std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator begin,
+      std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator end,
+      const MapOptions& options, MapCallback callback) const;
+
   // find overlaps between a pair of sequences
   std::vector<biosoup::Overlap> Map(
       const std::unique_ptr<biosoup::Sequence>& lhs,
       const std::unique_ptr<biosoup::Sequence>& rhs, bool micromize = false,
       std::uint8_t N = 0) const;  // only lhs
 
+  // base-level alignment of an overlap found by Map (rhs is the target),
+  // gaps between its minimizer matches are filled with banded global
+  // alignment; stores an extended CIGAR (=, X, I, D) into
+  // overlap->alignment, reversed for overlaps on the opposite strand, or
+  // leaves it empty if a gap between matches is too large to be aligned
+  void Align(const std::unique_ptr<biosoup::Sequence>& lhs,
+             const std::unique_ptr<biosoup::Sequence>& rhs,
+             biosoup::Overlap* overlap) const;
+
   uint64_t GetMinimizerIndexSize() const;
 
+  // estimated peak memory of Minimize(begin, end) per target base, used to
+  // size target chunks
+  double BytesPerBase() const;
+
  private:
   using uint128_t = std::pair<std::uint64_t, std::uint64_t>;
 
-  // Match = [127:97] rhs_id
-  //         [96:96] strand
-  //         [95:64] rhs_pos +- lhs_pos
-  //         [63:32] lhs_pos
-  //         [31:0] rhs_pos
-  std::vector<biosoup::Overlap> Chain(std::uint64_t lhs_id,
-                                      std::vector<uint128_t>&& matches) const;
+  // sort the sketch by kmer and append anchors of its matches in the index
+  // (only with targets, sorted, if given)
+  void Collect(std::vector<uint128_t>* sketch, std::uint64_t lhs_id,
+               bool avoid_equal, bool avoid_symmetric,
+               const std::vector<std::uint32_t>& targets,
+               std::vector<std::uint32_t>* groups,
+               std::vector<std::uint64_t>* anchors) const;
+
+  // Group = [31:1] rhs_id
+  //         [0:0] strand
+  // Anchor = [63:32] rhs_pos +- lhs_pos
+  //          [31:0] lhs_pos
+  // (rhs_pos is recovered from the diagonal, lhs_pos and strand)
+  std::vector<biosoup::Overlap> Chain(
+      std::uint64_t lhs_id,
+      std::vector<std::uint32_t>&& groups,          // one per anchor
+      std::vector<std::uint64_t>&& anchors) const;  // only Anchor
 
   // Minimizer = [127:64] kmer
   //             [63:32] id
@@ -90,18 +259,86 @@ class MinimizerEngine {
       bool micromize = false, double micromize_factor = 0.,
       std::uint8_t N = 0) const;
 
-  std::vector<uint128_t> Reduce(const std::vector<uint128_t>& dst) const;
+  // keep the smallest minimizer of each window of reduce_win_sz_ minimizers
+  // (in place)
+  void Reduce(std::vector<uint128_t>* dst) const;
 
-  template <typename T>
-  static void RadixSort(  // any uint128_t
-      std::vector<uint128_t>::iterator begin,
-      std::vector<uint128_t>::iterator end, std::uint8_t max_bits,
+  // redistribute minimizers_ into num_bins bins (power of 2), clears index_
+  void Repartition(std::uint64_t num_bins);
+
+  std::uint64_t NumBins() const;
+
+  // postings of a bin, from minimizers_ or the attached file
+  std::pair<const uint128_t*, const uint128_t*> Postings(
+      std::uint64_t bin) const;
+
+  // postings of a kmer (empty range if absent)
+  std::pair<const uint128_t*, const uint128_t*> Lookup(
+      std::uint64_t kmer) const;
+
+  void ClearCache();
+
+  // record lengths of targets (for MapCost and skip_contained)
+  void AddTargets(
+      std::vector<std::pair<std::uint32_t, std::uint64_t>>&& targets,
+      bool append);
+
+  // Minimize, Collect and Chain without the cache and containment flags
+  std::vector<biosoup::Overlap> MapSketch(
+      const std::unique_ptr<biosoup::Sequence>& sequence, bool avoid_equal,
+      bool avoid_symmetric, bool micromize = false,
+      double micromize_factor = 0., std::uint8_t N = 0) const;
+
+  // with skip_contained, flag the contained side of each overlap and drop
+  // overlaps with flagged targets, all of them if sequence is contained
+  bool IsFlagged(std::uint64_t id) const;
+  void FlagContained(const std::unique_ptr<biosoup::Sequence>& sequence,
+                     std::vector<biosoup::Overlap>* overlaps) const;
+
+  // mark kmers of the downweight_frequency most frequent ones in sketches
+  void BuildDownweight(const std::vector<std::vector<uint128_t>>& sketches);
+  bool IsDownweighted(std::uint64_t kmer) const {
+    return downweight_[(kmer >> 6) & downweight_mask_] >> (kmer & 63) & 1;
+  }
+
+  // filter of kmers with at most occurrence_ postings, cleared by Minimize
+  // and Attach; false positives fall through to Lookup
+  void BuildPrefilter();
+  bool MayContain(std::uint64_t kmer) const;
+
+  // Store file = [header] [num_bins + 1 offsets] [postings] [downweight_]
+  // [targets, id << 32 | length]
+  static constexpr std::uint32_t kIndexHeaderSize = 16;
+  std::vector<std::uint64_t> IndexHeader() const;
+
+  // sketching kernel specialized for kmer length (0 = runtime k_),
+  // homopolymer compression, robust winnowing and base masking
+  template <std::uint32_t K, bool kHpc, bool kRobust, bool kMask>
+  std::vector<uint128_t> Sketch(
+      const std::unique_ptr<biosoup::Sequence>& sequence) const;
+
+  using Kernel = std::vector<uint128_t> (MinimizerEngine::*)(
+      const std::unique_ptr<biosoup::Sequence>&) const;
+
+  template <std::uint32_t K>
+  static Kernel SelectKernel(bool hpc, bool robust_winnowing, bool mask);
+
+  // sampling kernel for syncmers and mod-minimizers (runtime kmer length)
+  template <Sampling kSampling, bool kHpc, bool kMask>
+  std::vector<uint128_t> Sample(
+      const std::unique_ptr<biosoup::Sequence>& sequence) const;
+
+  static Kernel SelectSampler(Sampling sampling, bool hpc, bool mask);
+
+  template <typename I, typename T>
+  static void RadixSort(  // any random access iterator
+      I begin, I end, std::uint8_t max_bits,
       T compare);  //  unary comparison function
 
   template <typename T>
-  static std::vector<std::uint64_t> LongestSubsequence(  // only Match
-      std::vector<uint128_t>::const_iterator begin,
-      std::vector<uint128_t>::const_iterator end,
+  static std::vector<std::uint64_t> LongestSubsequence(  // only Anchor
+      std::vector<std::uint64_t>::const_iterator begin,
+      std::vector<std::uint64_t>::const_iterator end, std::uint64_t strand,
       T compare);  // binary comparison function
 
   std::uint32_t k_;
@@ -114,10 +351,45 @@ class MinimizerEngine {
   std::uint32_t reduce_win_sz_;
   bool robust_winnowing_;
   bool hpc_;
-  std::vector<std::vector<uint128_t>> minimizers_;
+  bool mask_ambiguous_;
+  bool mask_lowercase_;
+  Sampling sampling_;
+  std::uint32_t s_;
+  Kernel sketch_;
+  std::vector<std::vector<uint128_t>> minimizers_;  // by kmer, then by id
   std::vector<std::unordered_map<  // kmer -> (begin, count)
       std::uint64_t, std::pair<std::uint32_t, std::uint32_t>>>
       index_;
+  Statistics stats_;
+  std::shared_ptr<const char> mapping_;  // attached index file, if any
+  std::uint64_t mapping_size_;
+  std::uint64_t mapped_bins_;
+  const std::uint64_t* mapped_offsets_;
+  const uint128_t* mapped_postings_;
+  struct CacheShard {  // hash -> (check hash, overlaps)
+    std::mutex mutex;
+    std::unordered_map<std::uint64_t,
+                       std::pair<std::uint64_t, std::vector<biosoup::Overlap>>>
+        entries;
+    std::deque<std::uint64_t> order;  // first in, first evicted
+  };
+  static constexpr std::uint32_t kCacheShards = 16;
+  std::vector<std::unique_ptr<CacheShard>> cache_;
+  std::uint32_t cache_capacity_;  // per shard
+  std::vector<std::atomic<std::uint64_t>> prefilter_;  // 512 bit blocks
+  std::uint64_t prefilter_mask_;
+  std::uint32_t max_per_target_;
+  bool skip_contained_;
+  std::vector<std::uint32_t> lengths_;  // target lengths by id, 0 = unknown
+  mutable std::vector<std::atomic<bool>> contained_;  // by id, set by Map
+  double downweight_frequency_;
+  std::uint32_t max_postings_;
+  std::vector<std::uint64_t> downweight_;  // bits of frequent kmers
+  std::uint64_t downweight_mask_;
+  // (id, bases of targets with id >= it) of indexed targets by id, see MapCost
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> target_bases_;
+  Placement placement_;
+  std::vector<std::uint32_t> interleave_nodes_;  // with kInterleave
   std::shared_ptr<thread_pool::ThreadPool> thread_pool_;
 };
 
@@ -0,0 +1,86 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAM_OVERLAP_FILE_HPP_
+#define RAM_OVERLAP_FILE_HPP_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ram {
+
+// Binary overlaps, a compact alternative to PAF
+//   file   = "ramovl01" block...
+//   block  = [u32 type] [u32 raw size] [u32 stored size] [payload]
+//            (payload is zlib compressed if stored size < raw size)
+//   kNames    payload = ([u32 length] [name] [u32 sequence length])...
+//                       (indices continue over blocks, starting at 0)
+//   kOverlaps payload = OverlapRecord...
+struct OverlapRecord {
+  std::uint32_t lhs;  // name index
+  std::uint32_t lhs_begin;
+  std::uint32_t lhs_end;
+  std::uint32_t rhs;  // name index
+  std::uint32_t rhs_begin;
+  std::uint32_t rhs_end;
+  std::uint32_t matches;  // PAF column 10
+  std::uint32_t length;   // PAF column 11
+  std::uint32_t strand;
+};
+
+class OverlapWriter {
+ public:
+  OverlapWriter(const std::string& path, bool compress);
+
+  OverlapWriter(const OverlapWriter&) = delete;
+  OverlapWriter& operator=(const OverlapWriter&) = delete;
+
+  ~OverlapWriter();  // flushes
+
+  // append to the name table, returns the index of the name
+  std::uint32_t AddName(const std::string& name, std::uint32_t length);
+
+  void Write(const OverlapRecord& record);
+
+  void Flush();
+
+ private:
+  void WriteBlock(std::uint32_t type, std::vector<char>* raw);
+
+  std::ofstream os_;
+  bool compress_;
+  std::uint32_t num_names_;
+  std::vector<char> names_;
+  std::vector<char> records_;
+};
+
+class OverlapReader {
+ public:
+  explicit OverlapReader(const std::string& path);
+
+  OverlapReader(const OverlapReader&) = delete;
+  OverlapReader& operator=(const OverlapReader&) = delete;
+
+  ~OverlapReader() = default;
+
+  // next record, false at the end of the file
+  bool Read(OverlapRecord* record);
+
+  // name table entries read so far, throw on an invalid index
+  const std::string& name(std::uint32_t i) const;
+  std::uint32_t length(std::uint32_t i) const;
+
+ private:
+  bool ReadBlock();
+
+  std::ifstream is_;
+  std::vector<std::string> names_;
+  std::vector<std::uint32_t> lengths_;
+  std::vector<char> records_;
+  std::uint64_t position_;
+};
+
+}  // namespace ram
+
+#endif  // RAM_OVERLAP_FILE_HPP_
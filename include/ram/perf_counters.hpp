@@ -0,0 +1,67 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAM_PERF_COUNTERS_HPP_
+#define RAM_PERF_COUNTERS_HPP_
+
+#include <cstdint>
+#include <ostream>
+
+namespace ram {
+
+// hardware counters of all threads summed per mapping stage, collected only
+// if built with RAM_PERF_COUNTERS (CMake option ram_perf_counters) and the
+// kernel allows perf_event_open; events which can not be counted stay zero
+class PerfCounters {
+ public:
+  enum Stage { kSketch, kLookup, kChain, kOutput, kNumStages };
+
+  enum Event {
+    kCycles,
+    kInstructions,
+    kLlcMisses,
+    kDtlbMisses,
+    kBranchMisses,
+    kNumEvents
+  };
+
+  // counts its lifetime on the calling thread into stage
+  class Scope {
+   public:
+#ifdef RAM_PERF_COUNTERS
+    explicit Scope(Stage stage);
+    ~Scope();
+#else
+    explicit Scope(Stage) {}
+#endif
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+#ifdef RAM_PERF_COUNTERS
+   private:
+    Stage stage_;
+    std::uint64_t begin_[kNumEvents + 2];  // and time enabled, running
+#endif
+  };
+
+  // event can be counted on the calling thread
+  static bool IsAvailable(Event event);
+
+  // counts are scaled by the share of time the counters were running in
+  // each scope, i.e. estimates if the kernel had to multiplex them
+  static std::uint64_t Get(Stage stage, Event event);
+
+  // share of the time since Reset the counters were running while enabled
+  // (1 if never enabled or not multiplexed)
+  static double Running();
+
+  static void Reset();
+
+  // one line per stage, a note if no event can be counted or the counters
+  // were multiplexed, nothing if not built with RAM_PERF_COUNTERS
+  static void Report(std::ostream& os);
+};
+
+}  // namespace ram
+
+#endif  // RAM_PERF_COUNTERS_HPP_
@@ -0,0 +1,261 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include <getopt.h>
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "biosoup/timer.hpp"
+#include "parser.hpp"
+#include "ram/minimizer_engine.hpp"
+#include "truth.hpp"
+
+std::atomic<std::uint32_t> biosoup::Sequence::num_objects{0};
+
+namespace {
+
+static struct option options[] = {
+    {"truth", required_argument, nullptr, 'T'},
+    {"kmer-length", required_argument, nullptr, 'k'},
+    {"window-length", required_argument, nullptr, 'w'},
+    {"frequency-threshold", required_argument, nullptr, 'f'},
+    {"Micromize", required_argument, nullptr, 'M'},
+    {"Micromize-factor", required_argument, nullptr, 'p'},
+    {"reduce-win-sz", required_argument, nullptr, 'i'},
+    {"begin-end", required_argument, nullptr, 'K'},
+    {"threads", required_argument, nullptr, 't'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0}};
+
+// comma separated values of an option
+template <typename T>
+std::vector<T> Values(const char* arg) {
+  std::vector<T> dst;
+  std::istringstream is(arg);
+  for (std::string value; std::getline(is, value, ',');) {
+    std::istringstream vs(value);
+    T it;
+    if (vs >> it) {
+      dst.emplace_back(it);
+    }
+  }
+  return dst;
+}
+
+// peak resident memory since the last reset, in GB; without
+// /proc/self/clear_refs the peak of the whole process
+void ResetPeakMemory() {
+#ifdef __GLIBC__
+  malloc_trim(0);  // release the heap of the previous configuration
+#endif
+  std::ofstream os("/proc/self/clear_refs");
+  os << "5";
+}
+
+double PeakMemory() {
+  std::ifstream is("/proc/self/status");
+  for (std::string line; std::getline(is, line);) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::atof(line.c_str() + 6) / (1U << 20);  // kB
+    }
+  }
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / static_cast<double>(1U << 20);
+}
+
+void Help() {
+  // clang-format off
+  std::cout
+      << "usage: ram_eval [options ...] <target> <sequences>\n"
+         "\n"
+         "  maps <sequences> to <target> with every combination of the\n"
+         "  listed parameters (comma separated), parsing the input once, and\n"
+         "  prints a table of throughput, index size, peak memory, recall and\n"
+         "  precision; a sequence is mapped correctly if its best overlap\n"
+         "  intersects its true interval on the same target and strand,\n"
+         "  recall is over sequences with truth, precision over those of\n"
+         "  them which are mapped\n"
+         "\n"
+         "  options:\n"
+         "    -T, --truth <path>\n"
+         "      true intervals of the sequences in PAF format (first record\n"
+         "      of each sequence)\n"
+         "    -k, --kmer-length <list>\n"
+         "      default: 15\n"
+         "    -w, --window-length <list>\n"
+         "      default: 5\n"
+         "    -f, --frequency-threshold <list>\n"
+         "      default: 0.001\n"
+         "    -M, --Micromize <list of 0|1>\n"
+         "      default: 0\n"
+         "    -p, --Micromize-factor <list>\n"
+         "      default: 0\n"
+         "    -i, --reduce-win-sz <list>\n"
+         "      default: 0\n"
+         "    -K, --begin-end <list>\n"
+         "      default: 0\n"
+         "    -t, --threads <int>\n"
+         "      default: 1\n"
+         "    -h, --help\n"
+         "      prints the usage\n";
+  // clang-format on
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string truth_path = "";
+  std::vector<std::uint32_t> ks{15};
+  std::vector<std::uint32_t> ws{5};
+  std::vector<double> fs{0.001};
+  std::vector<std::uint32_t> Ms{0};
+  std::vector<double> ps{0.};
+  std::vector<std::uint32_t> is{0};
+  std::vector<std::uint32_t> Ks{0};
+  std::uint32_t num_threads = 1;
+
+  const char* optstr = "T:k:w:f:M:p:i:K:t:h";
+  char arg;
+  // clang-format off
+  while ((arg = getopt_long(argc, argv, optstr, options, nullptr)) != -1) {
+    switch (arg) {
+      case 'T': truth_path = optarg; break;
+      case 'k': ks = Values<std::uint32_t>(optarg); break;
+      case 'w': ws = Values<std::uint32_t>(optarg); break;
+      case 'f': fs = Values<double>(optarg); break;
+      case 'M': Ms = Values<std::uint32_t>(optarg); break;
+      case 'p': ps = Values<double>(optarg); break;
+      case 'i': is = Values<std::uint32_t>(optarg); break;
+      case 'K': Ks = Values<std::uint32_t>(optarg); break;
+      case 't': num_threads = std::atoi(optarg); break;
+      case 'h': Help(); return 0;
+      default: return 1;
+    }
+  }
+  // clang-format on
+
+  if (argc - optind < 2 || truth_path.empty()) {
+    Help();
+    return 1;
+  }
+
+  std::unordered_map<std::string, ram::Truth> truths;
+  try {
+    truths = ram::LoadTruth(truth_path);
+  } catch (std::invalid_argument& exception) {
+    std::cerr << exception.what() << std::endl;
+    return 1;
+  }
+
+  auto tparser = ram::CreateParser(argv[optind]);
+  auto sparser = ram::CreateParser(argv[optind + 1]);
+  if (tparser == nullptr || sparser == nullptr) {
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<biosoup::Sequence>> targets, sequences;
+  try {
+    targets = tparser->Parse(-1);
+    biosoup::Sequence::num_objects = 0;
+    sequences = sparser->Parse(-1);
+  } catch (std::invalid_argument& exception) {
+    std::cerr << exception.what() << std::endl;
+    return 1;
+  }
+  if (targets.empty() || sequences.empty()) {
+    std::cerr << "[ram_eval::] error: empty input" << std::endl;
+    return 1;
+  }
+
+  std::uint64_t num_bases = 0, num_truths = 0;
+  for (const auto& it : sequences) {
+    num_bases += it->data.size();
+    num_truths += truths.count(it->name);
+  }
+  std::cerr << "[ram_eval::] " << targets.size() << " targets, "
+            << sequences.size() << " sequences (" << num_truths
+            << " with truth)" << std::endl;
+
+  auto thread_pool = std::make_shared<thread_pool::ThreadPool>(num_threads);
+
+  std::cout << "k\tw\tf\tM\tp\ti\tK\tminimizers\tindex_MB\tindex_s\tmap_s"
+            << "\tseqs_per_s\tMbp_per_s\tpeak_GB\tmapped\trecall\tprecision"
+            << std::endl;
+
+  struct Config {
+    std::uint32_t k, w;
+    double f;
+    std::uint32_t M;
+    double p;
+    std::uint32_t i, K;
+  };
+  std::vector<Config> configs;
+  for (auto k : ks) {
+    for (auto w : ws) {
+      for (auto f : fs) {
+        for (auto M : Ms) {
+          for (auto p : ps) {
+            for (auto i : is) {
+              for (auto K : Ks) {
+                configs.emplace_back(Config{k, w, f, M, p, i, K});
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  for (const auto& c : configs) {
+    ResetPeakMemory();
+    biosoup::Timer timer{};
+
+    timer.Start();
+    ram::MinimizerEngine minimizer_engine{
+        c.k, c.w, 100, 10000, 4, 0, c.i, false, false, thread_pool};
+    minimizer_engine.Minimize(targets.begin(), targets.end());
+    minimizer_engine.Filter(c.f);
+    double index_time = timer.Stop();
+
+    ram::MinimizerEngine::MapOptions options;
+    options.micromize = c.M;
+    options.micromize_factor = c.p;
+    options.K = c.K;
+
+    std::vector<std::vector<biosoup::Overlap>> overlaps(sequences.size());
+    timer.Start();
+    minimizer_engine
+        .MapBatch(sequences.begin(), sequences.end(), options,
+                  [&](const std::unique_ptr<biosoup::Sequence>& sequence,
+                      std::vector<biosoup::Overlap>&& dst) -> void {
+                    overlaps[sequence->id].swap(dst);  // distinct slots
+                  })
+        .get();
+    double map_time = timer.Stop();
+
+    auto accuracy = ram::Evaluate(targets, sequences, overlaps, truths);
+
+    std::cout << c.k << "\t" << c.w << "\t" << c.f << "\t" << c.M << "\t"
+              << c.p << "\t" << c.i << "\t" << c.K << "\t"
+              << minimizer_engine.GetMinimizerIndexSize() << "\t"
+              << minimizer_engine.Stats().num_bytes / 1e6 << "\t"
+              << index_time << "\t" << map_time << "\t"
+              << sequences.size() / map_time << "\t"
+              << num_bases / 1e6 / map_time << "\t" << PeakMemory() << "\t"
+              << accuracy.num_mapped << "\t" << accuracy.recall() << "\t"
+              << accuracy.precision() << std::endl;
+  }
+
+  return 0;
+}
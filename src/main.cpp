@@ -1,17 +1,23 @@
 // Copyright (c) 2020 Robert Vaser
 
 #include <getopt.h>
+#include <sys/resource.h>
 
 #include <bitset>
+#include <cctype>
 #include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <sstream>
 
-#include "bioparser/fasta_parser.hpp"
-#include "bioparser/fastq_parser.hpp"
 #include "biosoup/progress_bar.hpp"
 #include "biosoup/timer.hpp"
 
+#include "parser.hpp"
 #include "ram/minimizer_engine.hpp"
+#include "ram/overlap_file.hpp"
+#include "ram/perf_counters.hpp"
 
 std::atomic<std::uint32_t> biosoup::Sequence::num_objects{0};
 
@@ -24,11 +30,19 @@ static struct option options[] = {
     {"window-length", required_argument, nullptr, 'w'},
     {"robust_winnowing", no_argument, nullptr, 'r'},
     {"hpc", no_argument, nullptr, 'H'},
+    {"mask-ambiguous", no_argument, nullptr, 'A'},
+    {"mask-lowercase", no_argument, nullptr, 'L'},
+    {"sampling", required_argument, nullptr, 'S'},
+    {"smer-length", required_argument, nullptr, 's'},
     {"frequency-threshold", required_argument, nullptr, 'f'},
+    {"downweight", required_argument, nullptr, 'W'},
+    {"max-postings", required_argument, nullptr, 'Y'},
     {"Micromize", no_argument, nullptr, 'M'},
     {"Micromize-factor", required_argument, nullptr, 'p'},
     {"Micromize-extend", required_argument, nullptr, 'N'},
     {"begin-end", required_argument, nullptr, 'K'},
+    {"coarse-to-fine", required_argument, nullptr, 'C'},
+    {"align", no_argument, nullptr, 'E'},
     {"m", required_argument, nullptr, 'm'},
     {"g", required_argument, nullptr, 'g'},
     {"n", required_argument, nullptr, 'n'},
@@ -36,44 +50,124 @@ static struct option options[] = {
     {"reduce-win-sz", required_argument, nullptr, 'i'},
     {"preset-options", required_argument, nullptr, 'x'},
     {"threads", required_argument, nullptr, 't'},
+    {"numa", required_argument, nullptr, 'U'},
+    {"max-memory", required_argument, nullptr, 'B'},
+    {"unordered", no_argument, nullptr, 'u'},
+    {"binary-output", required_argument, nullptr, 'O'},
+    {"binary-compress", no_argument, nullptr, 'Z'},
+    {"to-paf", required_argument, nullptr, 'P'},
+    {"cache-size", required_argument, nullptr, 'c'},
+    {"max-per-target", required_argument, nullptr, 'q'},
+    {"skip-contained", no_argument, nullptr, 'X'},
+    {"store-index", required_argument, nullptr, 'I'},
+    {"attach-index", required_argument, nullptr, 'a'},
     {"version", no_argument, nullptr, 'v'},
     {"help", no_argument, nullptr, 'h'},
     {nullptr, 0, nullptr, 0}};
 
-std::unique_ptr<bioparser::Parser<biosoup::Sequence>> CreateParser(
-    const std::string& path) {
-  auto is_suffix = [](const std::string& s, const std::string& suff) {
-    return s.size() < suff.size()
-               ? false
-               : s.compare(s.size() - suff.size(), suff.size(), suff) == 0;
-  };
+double PeakMemory() {  // GB
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / static_cast<double>(1U << 20);  // kB on Linux
+}
 
-  if (is_suffix(path, ".fasta") || is_suffix(path, ".fa") ||
-      is_suffix(path, ".fasta.gz") || is_suffix(path, ".fa.gz")) {
-    try {
-      return bioparser::Parser<biosoup::Sequence>::Create<
-          bioparser::FastaParser>(path);  // NOLINT
-    } catch (const std::invalid_argument& exception) {
-      std::cerr << exception.what() << std::endl;
-      return nullptr;
+// residue matches and block length, from the CIGAR if aligned
+void Residues(const biosoup::Overlap& overlap, std::uint32_t* matches,
+              std::uint32_t* length) {
+  *matches = overlap.score;
+  *length = std::max(overlap.lhs_end - overlap.lhs_begin,
+                     overlap.rhs_end - overlap.rhs_begin);
+  if (!overlap.alignment.empty()) {
+    *matches = *length = 0;
+    std::uint32_t num = 0;
+    for (const auto& c : overlap.alignment) {
+      if (std::isdigit(c)) {
+        num = num * 10 + (c - '0');
+        continue;
+      }
+      *matches += c == '=' ? num : 0;
+      *length += num;
+      num = 0;
     }
   }
-  if (is_suffix(path, ".fastq") || is_suffix(path, ".fq") ||
-      is_suffix(path, ".fastq.gz") || is_suffix(path, ".fq.gz")) {
-    try {
-      return bioparser::Parser<biosoup::Sequence>::Create<
-          bioparser::FastqParser>(path);  // NOLINT
-    } catch (const std::invalid_argument& exception) {
-      std::cerr << exception.what() << std::endl;
-      return nullptr;
+}
+
+void PrintOverlaps(
+    const std::vector<biosoup::Overlap>& overlaps,  // of sequence
+    const std::unique_ptr<biosoup::Sequence>& sequence,
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& targets,
+    std::ostream& os) {
+  ram::PerfCounters::Scope scope{ram::PerfCounters::kOutput};
+  std::uint64_t rhs_offset = targets.front()->id;
+  for (const auto& jt : overlaps) {
+    std::uint32_t matches, length;
+    Residues(jt, &matches, &length);
+    // clang-format off
+    os << sequence->name << "\t"
+       << sequence->data.size() << "\t"
+       << jt.lhs_begin << "\t"
+       << jt.lhs_end << "\t"
+       << (jt.strand ? "+" : "-") << "\t"
+       << targets[jt.rhs_id - rhs_offset]->name << "\t"
+       << targets[jt.rhs_id - rhs_offset]->data.size() << "\t"
+       << jt.rhs_begin << "\t"
+       << jt.rhs_end << "\t"
+       << matches << "\t"
+       << length << "\t"
+       << 255;
+    if (!jt.alignment.empty()) {
+      os << "\tcg:Z:" << jt.alignment;
     }
+    os << std::endl;
+    // clang-format on
+  }
+}
+
+// name indices are ids shifted by lhs_offset (rhs_offset)
+void WriteOverlaps(const std::vector<biosoup::Overlap>& overlaps,
+                   std::uint64_t lhs_offset, std::uint64_t rhs_offset,
+                   ram::OverlapWriter* writer) {
+  ram::PerfCounters::Scope scope{ram::PerfCounters::kOutput};
+  for (const auto& it : overlaps) {
+    ram::OverlapRecord record{};
+    record.lhs = it.lhs_id + lhs_offset;
+    record.lhs_begin = it.lhs_begin;
+    record.lhs_end = it.lhs_end;
+    record.rhs = it.rhs_id + rhs_offset;
+    record.rhs_begin = it.rhs_begin;
+    record.rhs_end = it.rhs_end;
+    record.strand = it.strand;
+    Residues(it, &record.matches, &record.length);
+    writer->Write(record);
   }
+}
 
-  std::cerr << "[ram::CreateParser] error: file " << path
-            << " has unsupported format extension (valid extensions: .fasta, "
-            << ".fasta.gz, .fa, .fa.gz, .fastq, .fastq.gz, .fq, .fq.gz)"
-            << std::endl;
-  return nullptr;
+int ToPaf(const std::string& path) {
+  try {
+    ram::OverlapReader reader{path};
+    ram::OverlapRecord it;
+    while (reader.Read(&it)) {
+      // clang-format off
+      std::cout << reader.name(it.lhs) << "\t"
+                << reader.length(it.lhs) << "\t"
+                << it.lhs_begin << "\t"
+                << it.lhs_end << "\t"
+                << (it.strand ? "+" : "-") << "\t"
+                << reader.name(it.rhs) << "\t"
+                << reader.length(it.rhs) << "\t"
+                << it.rhs_begin << "\t"
+                << it.rhs_end << "\t"
+                << it.matches << "\t"
+                << it.length << "\t"
+                << 255
+                << "\n";
+      // clang-format on
+    }
+  } catch (std::invalid_argument& exception) {
+    std::cerr << exception.what() << std::endl;
+    return 1;
+  }
+  return 0;
 }
 
 void Help() {
@@ -100,9 +194,31 @@ void Help() {
          "      Use homopolymer-compressed (HPC) minimizers\n"
          "    -r, --robust-winnowing\n"
          "      Use robust winnowing while extracting minimizers (idea taken from Winnowmap)\n"
+         "    -A, --mask-ambiguous\n"
+         "      restart minimizer extraction at ambiguous bases (e.g. N) instead of\n"
+         "      encoding them as A or failing on unknown characters\n"
+         "    -L, --mask-lowercase\n"
+         "      restart minimizer extraction at soft-masked (lowercase) bases\n"
+         "    -S, --sampling minimizer|open-syncmer|closed-syncmer|mod-minimizer\n"
+         "      default: minimizer\n"
+         "      scheme used to sample kmers from sequences;\n"
+         "      syncmers are selected by the position of their smallest s-mer,\n"
+         "      mod-minimizers by the position of the smallest t-mer modulo w\n"
+         "    -s, --smer-length <int>\n"
+         "      default: 0\n"
+         "      length of s-mers (t-mers) used by syncmers (mod-minimizers);\n"
+         "      if zero: k - w + 1 for syncmers, 4 + (k - 4) % w for mod-minimizers\n"
          "    -f, --frequency-threshold <float>\n"
          "      default: 0.001\n"
          "      threshold for ignoring most frequent minimizers\n"
+         "    -W, --downweight <float>\n"
+         "      default: 0\n"
+         "      choose the <float> most frequent target minimizers only in windows\n"
+         "      without other ones (weighted minimizers, idea taken from Winnowmap)\n"
+         "    -Y, --max-postings <int>\n"
+         "      default: 0\n"
+         "      drop minimizers occurring more than <int> times from the index;\n"
+         "      if zero all minimizers will be kept\n"
          "    -M, --Micromize\n"
          "      use only a portion of all minimizers\n"
          "    -p, --Micromize-factor <float>\n"
@@ -116,6 +232,15 @@ void Help() {
          "    -K, --begin-end <int>\n"
          "      when greater than zero, begin-end strategy will be used\n"
          "      default: 0\n"
+         "    -E, --align\n"
+         "      align overlaps at base level (gaps between minimizer matches are\n"
+         "      filled with banded alignment); outputs residue matches, block\n"
+         "      length and an extended CIGAR (cg:Z tag)\n"
+         "    -C, --coarse-to-fine <float>\n"
+         "      when greater than zero, map with micromizers (-p <float>) first\n"
+         "      and remap only empty or ambiguous results with all minimizers\n"
+         "      against the targets found\n"
+         "      default: 0\n"
          "    -m <int>\n"
          "      default: 100\n"
          "      discard chains with chaining score less than <int>\n"
@@ -141,6 +266,47 @@ void Help() {
          "    -t, --threads <int>\n"
          "      default: 1\n"
          "      number of threads\n"
+         "    -U, --numa interleave|first-touch\n"
+         "      default: none\n"
+         "      pin threads round-robin to NUMA nodes and spread index pages\n"
+         "      over all nodes (interleave) or keep them on the node of the\n"
+         "      thread building them (first-touch)\n"
+         "    -O, --binary-output <path>\n"
+         "      write overlaps to <path> in ram's binary format instead of PAF\n"
+         "      to stdout (without CIGAR strings)\n"
+         "    -Z, --binary-compress\n"
+         "      compress blocks of the binary output with zlib\n"
+         "    -P, --to-paf <path>\n"
+         "      print binary overlaps stored at <path> as PAF and exit\n"
+         "    -B, --max-memory <float>\n"
+         "      default: 0\n"
+         "      memory budget in GB; if nonzero target and sequence chunks are\n"
+         "      sized so that their index and batch fit into <float> GB\n"
+         "    -u, --unordered\n"
+         "      write overlaps of each sequence as soon as it is mapped instead of\n"
+         "      in input order, and parse the next batch while the current one\n"
+         "      finishes\n"
+         "    -q, --max-per-target <int>\n"
+         "      default: 0\n"
+         "      keep only <int> best overlaps of each sequence with the same target;\n"
+         "      if zero all overlaps will be kept\n"
+         "    -X, --skip-contained\n"
+         "      in all-vs-all mode, skip sequences contained in longer ones and\n"
+         "      drop overlaps with them once they are found; which overlaps are\n"
+         "      dropped depends on the mapping order with more than one thread,\n"
+         "      use -t 1 for reproducible output\n"
+         "    -c, --cache-size <int>\n"
+         "      default: 0\n"
+         "      reuse overlaps of up to <int> distinct sequences for identical\n"
+         "      ones; not used in all-vs-all mode\n"
+         "    -I, --store-index <path>\n"
+         "      write the target index to <path>; the frequency threshold\n"
+         "      (-f) is not stored, it is applied again after attaching\n"
+         "    -a, --attach-index <path>\n"
+         "      map the index stored at <path> instead of indexing the target;\n"
+         "      processes attaching the same file share its memory\n"
+         "      (e.g. place it in /dev/shm), index options and targets have\n"
+         "      to match; with -I or -a the target has to fit into one chunk\n"
          "    --version\n"
          "      prints the version number\n"
          "    -h, --help\n"
@@ -155,11 +321,18 @@ int main(int argc, char** argv) {
   std::uint32_t w = 5;
   bool hpc = false;
   bool robust_winnowing = false;
+  bool mask_ambiguous = false;
+  bool mask_lowercase = false;
+  auto sampling = ram::MinimizerEngine::Sampling::kMinimizer;
+  std::string sampling_name = "minimizer";
+  std::uint32_t smer_len = 0;
   double frequency = 0.001;
   bool micromize = false;
   double micromize_factor = 0.;
   std::uint8_t N = 0;
   std::uint32_t K = 0;
+  double coarse_factor = 0.;
+  bool align = false;
   std::uint32_t m = 100;
   std::uint64_t g = 10000;
   std::uint8_t n = 4;
@@ -167,10 +340,24 @@ int main(int argc, char** argv) {
   std::uint32_t reduce_win_sz = 0;
   std::string preset = "";
   std::uint32_t num_threads = 1;
+  auto placement = ram::MinimizerEngine::Placement::kDefault;
+  std::string placement_name = "none";
+  double max_memory = 0.;
+  bool unordered = false;
+  std::string binary_path = "";
+  bool binary_compress = false;
+  std::uint32_t cache_size = 0;
+  std::uint32_t max_per_target = 0;
+  bool skip_contained = false;
+  double downweight_frequency = 0.;
+  std::uint32_t max_postings = 0;
+  std::string store_path = "";
+  std::string attach_path = "";
 
   std::vector<std::string> input_paths;
 
-  const char* optstr = "k:w:Hrf:Mp:N:K:m:g:n:b:i:x:t:h";
+  const char* optstr =
+      "k:w:HrALS:s:f:W:Y:Mp:N:K:C:Em:g:n:b:i:x:t:U:B:uO:ZP:c:q:XI:a:h";
   char arg;
   // clang-format off
   while ((arg = getopt_long(argc, argv, optstr, options, nullptr)) != -1) {
@@ -179,11 +366,35 @@ int main(int argc, char** argv) {
       case 'w': w = std::atoi(optarg); break;
       case 'H': hpc = true; break;
       case 'r': robust_winnowing = true; break;
+      case 'A': mask_ambiguous = true; break;
+      case 'L': mask_lowercase = true; break;
+      case 'S':
+        sampling_name = optarg;
+        if (sampling_name == "minimizer") {
+          sampling = ram::MinimizerEngine::Sampling::kMinimizer;
+          break;
+        } else if (sampling_name == "open-syncmer") {
+          sampling = ram::MinimizerEngine::Sampling::kOpenSyncmer;
+          break;
+        } else if (sampling_name == "closed-syncmer") {
+          sampling = ram::MinimizerEngine::Sampling::kClosedSyncmer;
+          break;
+        } else if (sampling_name == "mod-minimizer") {
+          sampling = ram::MinimizerEngine::Sampling::kModMinimizer;
+          break;
+        }
+        Help();
+        return 1;
+      case 's': smer_len = std::atoi(optarg); break;
       case 'f': frequency = std::atof(optarg); break;
+      case 'W': downweight_frequency = std::atof(optarg); break;
+      case 'Y': max_postings = std::atoi(optarg); break;
       case 'M': micromize = true; break;
       case 'p': micromize_factor = std::atof(optarg); break;
       case 'N': N = std::atoi(optarg); break;
       case 'K': K = std::atoi(optarg); break;
+      case 'C': coarse_factor = std::atof(optarg); break;
+      case 'E': align = true; break;
       case 'm': m = std::atoi(optarg); break;
       case 'g': g = std::atoll(optarg); break;
       case 'n': n = std::atoi(optarg); break;
@@ -201,6 +412,27 @@ int main(int argc, char** argv) {
         Help();
         return 1;
       case 't': num_threads = std::atoi(optarg); break;
+      case 'U':
+        placement_name = optarg;
+        if (placement_name == "interleave") {
+          placement = ram::MinimizerEngine::Placement::kInterleave;
+          break;
+        } else if (placement_name == "first-touch") {
+          placement = ram::MinimizerEngine::Placement::kFirstTouch;
+          break;
+        }
+        Help();
+        return 1;
+      case 'B': max_memory = std::atof(optarg); break;
+      case 'u': unordered = true; break;
+      case 'O': binary_path = optarg; break;
+      case 'Z': binary_compress = true; break;
+      case 'P': return ToPaf(optarg);
+      case 'c': cache_size = std::atoi(optarg); break;
+      case 'q': max_per_target = std::atoi(optarg); break;
+      case 'X': skip_contained = true; break;
+      case 'I': store_path = optarg; break;
+      case 'a': attach_path = optarg; break;
       case 'v': std::cout << ram_version << std::endl; return 0;
       case 'h': Help(); return 0;
       default: return 1;
@@ -213,14 +445,31 @@ int main(int argc, char** argv) {
     return 0;
   }
 
+  if (robust_winnowing &&
+      sampling != ram::MinimizerEngine::Sampling::kMinimizer) {
+    std::cerr << "[ram::] error: robust winnowing (-r) requires minimizer "
+              << "sampling" << std::endl;
+    return 1;
+  }
+
   std::cerr << "[ram::] using options: "
             << "k = " << k << ", w = " << w << ", hpc: " << hpc
-            << ", robust_win: " << robust_winnowing << ", f = " << frequency
+            << ", robust_win: " << robust_winnowing
+            << ", mask_ambiguous: " << mask_ambiguous
+            << ", mask_lowercase: " << mask_lowercase
+            << ", sampling: " << sampling_name << ", s = " << smer_len
+            << ", f = " << frequency << ", W = " << downweight_frequency
+            << ", Y = " << max_postings
             << ", M = " << micromize << ", p = " << micromize_factor
-            << ", N = " << (int)N << ", K = " << (int)K << ", m = " << m
+            << ", N = " << (int)N << ", K = " << (int)K
+            << ", C = " << coarse_factor << ", E = " << align << ", m = " << m
             << ", g = " << g << ", n = " << (int)n << ", b = " << b
             << ", reduce_win_sz = " << reduce_win_sz << ", x = " << preset
-            << ", t = " << num_threads << std::endl;
+            << ", t = " << num_threads << ", U = " << placement_name
+            << ", B = " << max_memory
+            << ", u = " << unordered
+            << ", c = " << cache_size << ", q = " << max_per_target
+            << ", X = " << skip_contained << std::endl;
 
   for (auto i = optind; i < argc; ++i) {
     input_paths.emplace_back(argv[i]);
@@ -231,7 +480,7 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  auto tparser = CreateParser(input_paths[0]);
+  auto tparser = ram::CreateParser(input_paths[0]);
   if (tparser == nullptr) {
     return 1;
   }
@@ -239,19 +488,58 @@ int main(int argc, char** argv) {
   bool is_ava = false;
   std::unique_ptr<bioparser::Parser<biosoup::Sequence>> sparser = nullptr;
   if (input_paths.size() > 1) {
-    sparser = CreateParser(input_paths[1]);
+    sparser = ram::CreateParser(input_paths[1]);
     if (sparser == nullptr) {
       return 1;
     }
     is_ava = input_paths[0] == input_paths[1];
   } else {
-    sparser = CreateParser(input_paths[0]);
+    sparser = ram::CreateParser(input_paths[0]);
     is_ava = true;
   }
 
+  std::unique_ptr<ram::OverlapWriter> writer;
+  if (!binary_path.empty()) {
+    try {
+      writer.reset(new ram::OverlapWriter(binary_path, binary_compress));
+    } catch (std::invalid_argument& exception) {
+      std::cerr << exception.what() << std::endl;
+      return 1;
+    }
+  }
+
   auto thread_pool = std::make_shared<thread_pool::ThreadPool>(num_threads);
+  ram::MinimizerEngine::Options engine_options;
+  engine_options.mask_ambiguous = mask_ambiguous;
+  engine_options.mask_lowercase = mask_lowercase;
+  engine_options.sampling = sampling;
+  engine_options.smer_len = smer_len;
+  engine_options.cache_size = cache_size;
+  engine_options.max_per_target = max_per_target;
+  engine_options.skip_contained = skip_contained;
+  engine_options.downweight_frequency = downweight_frequency;
+  engine_options.max_postings = max_postings;
+  engine_options.placement = placement;
   ram::MinimizerEngine minimizer_engine{
-      k, w, m, g, n, b, reduce_win_sz, robust_winnowing, hpc, thread_pool};
+      k, w, m, g, n, b, reduce_win_sz, robust_winnowing, hpc, thread_pool,
+      engine_options};
+
+  std::uint64_t target_chunk = 1ULL << 32;
+  std::uint64_t sequence_chunk = 1U << 29;
+  if (max_memory > 0.) {
+    // three quarters of the budget for the index, the rest for a batch of
+    // sequences with their sketches and overlaps (about 2 B per base)
+    double budget = max_memory * (1ULL << 30);
+    target_chunk = std::max<std::uint64_t>(
+        std::min<double>(target_chunk,
+                         0.75 * budget / minimizer_engine.BytesPerBase()),
+        1U << 20);
+    sequence_chunk = std::max<std::uint64_t>(
+        std::min<double>(sequence_chunk, 0.25 * budget / 2), 1U << 20);
+    std::cerr << "[ram::] using chunks of " << target_chunk
+              << " target and " << sequence_chunk << " sequence bytes"
+              << std::endl;
+  }
 
   biosoup::Timer timer{};
 
@@ -260,7 +548,7 @@ int main(int argc, char** argv) {
 
     std::vector<std::unique_ptr<biosoup::Sequence>> targets;
     try {
-      targets = tparser->Parse(1ULL << 32);
+      targets = tparser->Parse(target_chunk);
     } catch (std::invalid_argument& exception) {
       std::cerr << exception.what() << std::endl;
       return 1;
@@ -273,26 +561,110 @@ int main(int argc, char** argv) {
     std::cerr << "[ram::] parsed " << targets.size() << " targets "
               << std::fixed << timer.Stop() << "s" << std::endl;
 
+    if (!store_path.empty() || !attach_path.empty()) {  // one index only
+      std::vector<std::unique_ptr<biosoup::Sequence>> rest;
+      try {
+        rest = tparser->Parse(1);
+      } catch (std::invalid_argument& exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+      }
+      if (!rest.empty()) {
+        std::cerr << "[ram::] error: target does not fit into a single index"
+                  << std::endl;
+        return 1;
+      }
+    }
+
     timer.Start();
 
-    minimizer_engine.Minimize(targets.begin(), targets.end());
-    minimizer_engine.Filter(frequency);
+    try {
+      if (attach_path.empty()) {
+        minimizer_engine.Minimize(targets.begin(), targets.end());
+      } else {
+        minimizer_engine.Attach(attach_path);
+        auto lengths = minimizer_engine.TargetLengths();
+        bool is_equal = lengths.size() == targets.size();
+        for (std::uint64_t i = 0; is_equal && i < targets.size(); ++i) {
+          is_equal = lengths[i].first == targets[i]->id &&
+                     lengths[i].second == targets[i]->data.size();
+        }
+        if (!is_equal) {
+          throw std::invalid_argument(
+              "[ram::] error: index " + attach_path +
+              " was not built from the given targets");
+        }
+      }
+      minimizer_engine.Filter(frequency);
+      if (!store_path.empty()) {
+        minimizer_engine.Store(store_path);
+      }
+    } catch (std::invalid_argument& exception) {
+      std::cerr << exception.what() << std::endl;
+      return 1;
+    }
 
     std::cerr << "[ram::] minimized targets " << std::fixed << timer.Stop()
               << "s" << std::endl;
     std::cerr << "[ram::] targets produced "
               << minimizer_engine.GetMinimizerIndexSize() << " minimizers"
               << std::endl;
+    std::cerr << "[ram::] peak memory " << PeakMemory() << " GB" << std::endl;
 
     std::uint64_t num_targets = biosoup::Sequence::num_objects;
     biosoup::Sequence::num_objects = 0;
 
+    std::uint64_t rhs_offset = 0;  // name index - id
+    if (writer) {
+      rhs_offset = writer->AddName(targets.front()->name,
+                                   targets.front()->data.size()) -
+                   targets.front()->id;
+      for (std::uint64_t i = 1; i < targets.size(); ++i) {
+        writer->AddName(targets[i]->name, targets[i]->data.size());
+      }
+    }
+
+    ram::MinimizerEngine::MapOptions options;
+    options.avoid_equal = options.avoid_symmetric = is_ava;
+    options.micromize = micromize;
+    options.micromize_factor = micromize_factor;
+    options.N = N;
+    options.K = K;
+    options.coarse_factor = coarse_factor;
+
+    auto align_overlaps = [&](
+        const std::unique_ptr<biosoup::Sequence>& sequence,
+        std::vector<biosoup::Overlap>* overlaps) -> void {
+      if (align) {
+        for (auto& it : *overlaps) {
+          minimizer_engine.Align(
+              sequence, targets[it.rhs_id - targets.front()->id], &it);
+        }
+      }
+    };
+
+    std::mutex output_mutex;
+    std::vector<std::unique_ptr<biosoup::Sequence>> draining;  // unordered
+    std::future<void> draining_future;
+    auto drain = [&]() -> void {
+      if (draining_future.valid()) {
+        draining_future.get();
+      }
+      if (!draining.empty()) {
+        std::cerr << "[ram::] mapped " << draining.size() << " sequences "
+                  << std::fixed << timer.Stop() << "s" << std::endl;
+      }
+      draining.clear();
+    };
+
     while (true) {
-      timer.Start();
+      if (!unordered) {
+        timer.Start();
+      }
 
       std::vector<std::unique_ptr<biosoup::Sequence>> sequences;
       try {
-        sequences = sparser->Parse(1U << 29);
+        sequences = sparser->Parse(sequence_chunk);
       } catch (std::invalid_argument& exception) {
         std::cerr << exception.what() << std::endl;
         return 1;
@@ -302,65 +674,98 @@ int main(int argc, char** argv) {
         break;
       }
 
-      std::vector<std::future<std::vector<biosoup::Overlap>>> futures;
-      for (const auto& it : sequences) {
-        futures.emplace_back(thread_pool->Submit(
-            [&](const std::unique_ptr<biosoup::Sequence>& sequence)
-                -> std::vector<biosoup::Overlap> {
-              if (!K)
-                return minimizer_engine.Map(sequence, is_ava, is_ava, micromize,
-                                            micromize_factor, N);
-              else
-                return minimizer_engine.MapBeginEnd(sequence, is_ava, is_ava,
-                                                    K);
-            },
-            std::ref(it)));
+      std::uint64_t lhs_offset = 0;  // name index - id
+      if (writer) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        lhs_offset = writer->AddName(sequences.front()->name,
+                                     sequences.front()->data.size()) -
+                     sequences.front()->id;
+        for (std::uint64_t i = 1; i < sequences.size(); ++i) {
+          writer->AddName(sequences[i]->name, sequences[i]->data.size());
+        }
       }
 
-      biosoup::ProgressBar bar{static_cast<std::uint32_t>(sequences.size()),
-                               16};
-
-      std::uint64_t rhs_offset = targets.front()->id;
-      std::uint64_t lhs_offset = sequences.front()->id;
-      for (auto& it : futures) {
-        for (const auto& jt : it.get()) {
-          // clang-format off
-          std::cout << sequences[jt.lhs_id - lhs_offset]->name << "\t"
-                    << sequences[jt.lhs_id - lhs_offset]->data.size() << "\t"
-                    << jt.lhs_begin << "\t"
-                    << jt.lhs_end << "\t"
-                    << (jt.strand ? "+" : "-") << "\t"
-                    << targets[jt.rhs_id - rhs_offset]->name << "\t"
-                    << targets[jt.rhs_id - rhs_offset]->data.size() << "\t"
-                    << jt.rhs_begin << "\t"
-                    << jt.rhs_end << "\t"
-                    << jt.score << "\t"
-                    << std::max(
-                          jt.lhs_end - jt.lhs_begin,
-                          jt.rhs_end - jt.rhs_begin) << "\t"
-                    << 255
-                    << std::endl;
-          // clang-format on
+      if (unordered) {  // previous batch drains while this one is parsed
+        auto future = minimizer_engine.MapBatch(
+            sequences.begin(), sequences.end(), options,
+            [&, lhs_offset](const std::unique_ptr<biosoup::Sequence>& sequence,
+                            std::vector<biosoup::Overlap>&& overlaps) -> void {
+              align_overlaps(sequence, &overlaps);
+              if (writer) {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                WriteOverlaps(overlaps, lhs_offset, rhs_offset, writer.get());
+                return;
+              }
+              std::ostringstream os;
+              PrintOverlaps(overlaps, sequence, targets, os);
+              std::lock_guard<std::mutex> lock(output_mutex);
+              std::cout << os.str();
+            });
+        drain();
+        timer.Start();
+        draining.swap(sequences);  // keeps the elements in place
+        draining_future = std::move(future);
+      } else {
+        // most expensive sequences are submitted first so that cheap ones
+        // fill the gaps at the end of the batch, futures stay in input order
+        std::vector<double> costs;
+        for (const auto& it : sequences) {
+          costs.emplace_back(minimizer_engine.MapCost(it, options));
+        }
+        std::vector<std::uint32_t> order(sequences.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&](std::uint32_t lhs, std::uint32_t rhs) -> bool {
+                           return costs[lhs] > costs[rhs];
+                         });
+
+        std::vector<std::future<std::vector<biosoup::Overlap>>> futures(
+            sequences.size());
+        for (const auto& i : order) {
+          futures[i] = thread_pool->Submit(
+              [&](const std::unique_ptr<biosoup::Sequence>& sequence)
+                  -> std::vector<biosoup::Overlap> {
+                auto overlaps = minimizer_engine.Map(sequence, options);
+                align_overlaps(sequence, &overlaps);
+                return overlaps;
+              },
+              std::ref(sequences[i]));
         }
 
-        if (++bar) {
-          std::cerr << "[ram::] mapped " << bar.event_counter() << " sequences "
-                    << "[" << bar << "] " << std::fixed << timer.Lap() << "s"
-                    << "\r";
+        biosoup::ProgressBar bar{static_cast<std::uint32_t>(sequences.size()),
+                                 16};
+
+        for (std::uint64_t i = 0; i < futures.size(); ++i) {
+          if (writer) {
+            WriteOverlaps(futures[i].get(), lhs_offset, rhs_offset,
+                          writer.get());
+          } else {
+            PrintOverlaps(futures[i].get(), sequences[i], targets, std::cout);
+          }
+
+          if (++bar) {
+            std::cerr << "[ram::] mapped " << bar.event_counter()
+                      << " sequences "
+                      << "[" << bar << "] " << std::fixed << timer.Lap() << "s"
+                      << "\r";
+          }
         }
+        std::cerr << std::endl;
+        timer.Stop();
       }
-      std::cerr << std::endl;
-      timer.Stop();
 
       if (is_ava && biosoup::Sequence::num_objects == num_targets) {
         break;
       }
     }
+    drain();
+    std::cerr << "[ram::] peak memory " << PeakMemory() << " GB" << std::endl;
 
     sparser->Reset();
     biosoup::Sequence::num_objects = num_targets;
   }
 
+  ram::PerfCounters::Report(std::cerr);
   std::cerr << "[ram::] " << timer.elapsed_time() << "s" << std::endl;
 
   return 0;
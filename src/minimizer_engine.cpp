@@ -2,12 +2,31 @@
 
 #include "ram/minimizer_engine.hpp"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
 #include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <stdexcept>
+#include <thread>
+
+#include "numa.hpp"
+#include "ram/perf_counters.hpp"
 
 namespace {
 
@@ -15,14 +34,199 @@ static std::uint64_t First(const std::pair<std::uint64_t, std::uint64_t>& pr) {
   return pr.first;
 }
 
-static std::uint64_t Second(const std::pair<std::uint64_t, std::uint64_t>& pr) {
-  return pr.second;
+static bool FirstLess(const std::pair<std::uint64_t, std::uint64_t>& lhs,
+                      const std::pair<std::uint64_t, std::uint64_t>& rhs) {
+  return lhs.first < rhs.first;
+}
+
+static std::uint64_t Diagonal(std::uint64_t anchor) { return anchor >> 32; }
+
+static std::uint64_t LhsPos(std::uint64_t anchor) {
+  return anchor << 32 >> 32;
+}
+
+static std::uint64_t RhsPos(std::uint64_t anchor, std::uint64_t strand) {
+  return strand ? Diagonal(anchor) + LhsPos(anchor) - (3ULL << 30)
+                : Diagonal(anchor) - LhsPos(anchor);
+}
+
+static std::uint8_t Bits(std::uint64_t x) {
+  std::uint8_t dst = 0;
+  while (x >> dst) {
+    ++dst;
+  }
+  return dst;
+}
+
+static std::uint64_t Hash(std::uint64_t key, std::uint64_t mask) {
+  key = ((~key) + (key << 21)) & mask;
+  key = key ^ (key >> 24);
+  key = ((key + (key << 3)) + (key << 8)) & mask;
+  key = key ^ (key >> 14);
+  key = ((key + (key << 2)) + (key << 4)) & mask;
+  key = key ^ (key >> 28);
+  key = (key + (key << 31)) & mask;
+  return key;
+}
+
+static bool IsMasked(char c, bool mask_ambiguous, bool mask_lowercase) {
+  // clang-format off
+  switch (c) {
+    case 'A': case 'C': case 'G': case 'T': case 'U':
+      return false;
+    case 'a': case 'c': case 'g': case 't': case 'u':
+      return mask_lowercase;
+    default:
+      return mask_ambiguous || (mask_lowercase && 'a' <= c && c <= 'z');
+  }
+  // clang-format on
+}
+
+static char Complement(char c) {
+  // clang-format off
+  switch (c) {
+    case 'A': return 'T'; case 'C': return 'G';
+    case 'G': return 'C'; case 'T': case 'U': return 'A';
+    case 'a': return 't'; case 'c': return 'g';
+    case 'g': return 'c'; case 't': case 'u': return 'a';
+    default: return c;
+  }
+  // clang-format on
+}
+
+// 128 bit hash of data
+static std::pair<std::uint64_t, std::uint64_t> SequenceHash(
+    const std::string& data, std::uint64_t seed) {
+  std::uint64_t lhs = 0xcbf29ce484222325ULL ^ seed;
+  std::uint64_t rhs = Hash(seed + data.size(), -1);
+  for (std::uint64_t i = 0; i < data.size(); ++i) {
+    auto c = static_cast<std::uint8_t>(data[i]);
+    lhs = (lhs ^ c) * 0x100000001b3ULL;
+    rhs = (rhs + c) * 0x9e3779b97f4a7c15ULL;
+    rhs ^= rhs >> 29;
+  }
+  return std::make_pair(lhs, rhs);
+}
+
+// banded global alignment with unit costs, appends one op per column
+// ('=', 'X', 'I' for lhs only, 'D' for rhs only); false if the band is too
+// big to be filled
+static bool AlignSegment(const char* lhs, std::uint32_t lhs_len,
+                         const char* rhs, std::uint32_t rhs_len,
+                         std::string* ops) {
+  if (lhs_len == 0 || rhs_len == 0) {  // gaps only
+    ops->append(lhs_len, 'I');
+    ops->append(rhs_len, 'D');
+    return true;
+  }
+
+  const std::int64_t kBand = 16;
+  std::int64_t diff = static_cast<std::int64_t>(rhs_len) - lhs_len;
+  std::int64_t lo = std::min<std::int64_t>(0, diff) - kBand;
+  std::int64_t hi = std::max<std::int64_t>(0, diff) + kBand;
+  std::uint64_t width = hi - lo + 1;
+  if ((lhs_len + 1ULL) * width > (1ULL << 26)) {
+    return false;
+  }
+
+  // cell (i, j) is stored at row i, column j - i - lo
+  const std::uint32_t kInf = -1;
+  std::vector<std::uint32_t> prev(width + 2, kInf), curr(width + 2, kInf);
+  std::vector<std::uint8_t> trace((lhs_len + 1) * width, 0);
+  for (std::int64_t d = std::max<std::int64_t>(lo, 0);
+       d <= std::min<std::int64_t>(hi, rhs_len); ++d) {
+    prev[d - lo + 1] = d;
+    trace[d - lo] = 2;  // 'D'
+  }
+  for (std::int64_t i = 1; i <= lhs_len; ++i) {
+    std::fill(curr.begin(), curr.end(), kInf);
+    for (std::int64_t d = lo; d <= hi; ++d) {
+      std::int64_t j = i + d;
+      if (j < 0 || j > rhs_len) {
+        continue;
+      }
+      std::uint64_t c = d - lo + 1;
+      std::uint32_t best = kInf;
+      std::uint8_t op = 0;
+      if (j == 0) {
+        best = i, op = 1;
+      } else {
+        if (prev[c] != kInf) {  // (i - 1, j - 1)
+          best = prev[c] +
+                 (std::toupper(lhs[i - 1]) != std::toupper(rhs[j - 1]));
+          op = 0;
+        }
+        if (curr[c - 1] != kInf && curr[c - 1] + 1 < best) {  // (i, j - 1)
+          best = curr[c - 1] + 1, op = 2;
+        }
+      }
+      if (prev[c + 1] != kInf && prev[c + 1] + 1 < best) {  // (i - 1, j)
+        best = prev[c + 1] + 1, op = 1;
+      }
+      curr[c] = best;
+      trace[i * width + c - 1] = op;
+    }
+    prev.swap(curr);
+  }
+
+  std::string path;
+  for (std::int64_t i = lhs_len, j = rhs_len; i > 0 || j > 0;) {
+    switch (trace[i * width + (j - i - lo)]) {
+      case 0:
+        path.push_back(std::toupper(lhs[i - 1]) == std::toupper(rhs[j - 1])
+                           ? '='
+                           : 'X');
+        --i, --j;
+        break;
+      case 1: path.push_back('I'); --i; break;
+      default: path.push_back('D'); --j; break;
+    }
+  }
+  ops->append(path.rbegin(), path.rend());
+  return true;
+}
+
+// [begin, end) covers a sequence of length len up to small overhangs left by
+// chaining at the ends
+static bool IsContained(std::uint32_t begin, std::uint32_t end,
+                        std::uint32_t len) {
+  std::uint32_t overhang = std::max(100U, len / 50);
+  return begin <= overhang && end + overhang >= len;
+}
+
+// pin each worker of thread_pool to the cpus of a node, round-robin; tasks
+// wait until all have started, hence each runs on a distinct worker
+static void PinWorkers(thread_pool::ThreadPool* thread_pool,
+                       const std::vector<ram::numa::Node>& nodes) {
+  std::uint32_t num_threads = thread_pool->num_threads();
+  std::uint32_t num_started = 0;
+  std::mutex mutex;
+  std::condition_variable started;
+  std::vector<std::future<void>> futures;
+  for (std::uint32_t i = 0; i < num_threads; ++i) {
+    futures.emplace_back(thread_pool->Submit([&]() -> void {
+      std::uint32_t worker;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        worker = num_started++;
+        started.notify_all();
+        started.wait(lock,
+                     [&]() -> bool { return num_started == num_threads; });
+      }
+      ram::numa::Pin(nodes[worker % nodes.size()].cpus);
+    }));
+  }
+  for (const auto& it : futures) {
+    it.wait();
+  }
 }
 
 }  // namespace
 
 namespace ram {
 
+const char kIndexMagic[8] = {'r', 'a', 'm', 'i', 'd', 'x', '0', '1'};
+
 // clang-format off
 const std::vector<std::uint64_t> kCoder = {
     255, 255, 255, 255, 255, 255, 255, 255,
@@ -50,6 +254,19 @@ MinimizerEngine::MinimizerEngine(
     std::uint8_t chain_minimizer_cnt_treshold, std::uint32_t best_n,
     std::uint32_t reduce_win_sz, bool hpc, bool robust_winnowing,
     std::shared_ptr<thread_pool::ThreadPool> thread_pool)
+    : MinimizerEngine(kmer_len, window_len, chaining_score_treshold,
+                      chain_enlongation_stop_criteria,
+                      chain_minimizer_cnt_treshold, best_n, reduce_win_sz,
+                      hpc, robust_winnowing, thread_pool, Options()) {}
+
+MinimizerEngine::MinimizerEngine(
+    std::uint32_t kmer_len, std::uint32_t window_len,
+    std::uint32_t chaining_score_treshold,
+    std::uint64_t chain_enlongation_stop_criteria,
+    std::uint8_t chain_minimizer_cnt_treshold, std::uint32_t best_n,
+    std::uint32_t reduce_win_sz, bool hpc, bool robust_winnowing,
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+    const Options& options)
     : k_(std::min(std::max(kmer_len, 1U), 32U)),
       w_(window_len),
       occurrence_(-1),
@@ -60,29 +277,167 @@ MinimizerEngine::MinimizerEngine(
       reduce_win_sz_(reduce_win_sz),
       robust_winnowing_(robust_winnowing),
       hpc_(hpc),
-      minimizers_(1U << std::min(14U, 2 * k_)),
-      index_(minimizers_.size()),
+      mask_ambiguous_(options.mask_ambiguous),
+      mask_lowercase_(options.mask_lowercase),
+      sampling_(options.sampling),
+      s_(options.smer_len),
+      sketch_(nullptr),
+      minimizers_(1),
+      index_(1),
+      mapping_(nullptr),
+      mapping_size_(0),
+      mapped_bins_(0),
+      mapped_offsets_(nullptr),
+      mapped_postings_(nullptr),
+      cache_(),
+      cache_capacity_((options.cache_size + kCacheShards - 1) /
+                      kCacheShards),
+      prefilter_(),
+      prefilter_mask_(0),
+      max_per_target_(options.max_per_target),
+      skip_contained_(options.skip_contained),
+      lengths_(),
+      contained_(),
+      downweight_frequency_(options.downweight_frequency),
+      max_postings_(options.max_postings),
+      downweight_(),
+      downweight_mask_(0),
+      target_bases_(),
+      placement_(options.placement),
+      interleave_nodes_(),
       thread_pool_(thread_pool ? thread_pool
                                : std::make_shared<thread_pool::ThreadPool>(1)) {
+  if (cache_capacity_) {
+    for (std::uint32_t i = 0; i < kCacheShards; ++i) {
+      cache_.emplace_back(new CacheShard());
+    }
+  }
+
+  // windows order down-weighted kmers after all others with the bit above
+  // the kmer, hence there is none for k = 32; syncmers have no windows
+  if (sampling_ != Sampling::kMinimizer || k_ == 32) {
+    downweight_frequency_ = 0.;
+  }
+
+  if (placement_ != Placement::kDefault) {
+    if (thread_pool_->thread_ids().count(std::this_thread::get_id())) {
+      throw std::invalid_argument(
+          "[ram::MinimizerEngine::MinimizerEngine] error: placement needs "
+          "all workers, the engine can not be created from one of them");
+    }
+    auto nodes = numa::Nodes();
+    if (!nodes.empty()) {
+      PinWorkers(thread_pool_.get(), nodes);
+    }
+    if (placement_ == Placement::kInterleave) {
+      for (const auto& it : nodes) {
+        interleave_nodes_.emplace_back(it.id);
+      }
+    }
+  }
+
+  bool mask = mask_ambiguous_ || mask_lowercase_;
+  if (sampling_ != Sampling::kMinimizer) {
+    if (s_ == 0) {  // match minimizer density or use mod-minimizer r = 4
+      s_ = sampling_ == Sampling::kModMinimizer
+               ? (k_ > 4 ? 4 + (k_ - 4) % std::max(w_, 1U) : k_)
+               : (k_ > w_ ? k_ - w_ + 1 : 1);
+    }
+    s_ = std::min(s_, k_);
+    sketch_ = SelectSampler(sampling_, hpc_, mask);
+    return;
+  }
+  switch (k_) {
+    case 15: sketch_ = SelectKernel<15>(hpc_, robust_winnowing_, mask); break;
+    case 17: sketch_ = SelectKernel<17>(hpc_, robust_winnowing_, mask); break;
+    case 19: sketch_ = SelectKernel<19>(hpc_, robust_winnowing_, mask); break;
+    case 21: sketch_ = SelectKernel<21>(hpc_, robust_winnowing_, mask); break;
+    case 28: sketch_ = SelectKernel<28>(hpc_, robust_winnowing_, mask); break;
+    default: sketch_ = SelectKernel<0>(hpc_, robust_winnowing_, mask); break;
+  }
+}
+
+template <std::uint32_t K>
+MinimizerEngine::Kernel MinimizerEngine::SelectKernel(bool hpc,
+                                                      bool robust_winnowing,
+                                                      bool mask) {
+  // clang-format off
+  static const Kernel kernels[8] = {
+      &MinimizerEngine::Sketch<K, false, false, false>,
+      &MinimizerEngine::Sketch<K, false, false, true>,
+      &MinimizerEngine::Sketch<K, false, true,  false>,
+      &MinimizerEngine::Sketch<K, false, true,  true>,
+      &MinimizerEngine::Sketch<K, true,  false, false>,
+      &MinimizerEngine::Sketch<K, true,  false, true>,
+      &MinimizerEngine::Sketch<K, true,  true,  false>,
+      &MinimizerEngine::Sketch<K, true,  true,  true>};
+  // clang-format on
+  return kernels[hpc << 2 | robust_winnowing << 1 | mask];
+}
+
+MinimizerEngine::Kernel MinimizerEngine::SelectSampler(Sampling sampling,
+                                                       bool hpc, bool mask) {
+  // clang-format off
+  static const Kernel kernels[3][4] = {
+      {&MinimizerEngine::Sample<Sampling::kOpenSyncmer, false, false>,
+       &MinimizerEngine::Sample<Sampling::kOpenSyncmer, false, true>,
+       &MinimizerEngine::Sample<Sampling::kOpenSyncmer, true,  false>,
+       &MinimizerEngine::Sample<Sampling::kOpenSyncmer, true,  true>},
+      {&MinimizerEngine::Sample<Sampling::kClosedSyncmer, false, false>,
+       &MinimizerEngine::Sample<Sampling::kClosedSyncmer, false, true>,
+       &MinimizerEngine::Sample<Sampling::kClosedSyncmer, true,  false>,
+       &MinimizerEngine::Sample<Sampling::kClosedSyncmer, true,  true>},
+      {&MinimizerEngine::Sample<Sampling::kModMinimizer, false, false>,
+       &MinimizerEngine::Sample<Sampling::kModMinimizer, false, true>,
+       &MinimizerEngine::Sample<Sampling::kModMinimizer, true,  false>,
+       &MinimizerEngine::Sample<Sampling::kModMinimizer, true,  true>}};
+  // clang-format on
+  return kernels[static_cast<int>(sampling) - 1][hpc << 1 | mask];
 }
 
 void MinimizerEngine::Minimize(
     std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator begin,
-    std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator end) {
-  for (auto& it : minimizers_) {
-    it.clear();
+    std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator end,
+    bool append) {
+  if (append && begin >= end) {  // nothing to add, attached index stays
+    return;
+  }
+  ClearCache();
+  prefilter_.clear();
+
+  bool is_attached = mapping_ != nullptr;
+  if (is_attached) {
+    if (append) {  // copy the attached index so that it can grow
+      minimizers_.assign(mapped_bins_, std::vector<uint128_t>{});
+      for (std::uint64_t i = 0; i < mapped_bins_; ++i) {
+        auto postings = Postings(i);
+        minimizers_[i].assign(postings.first, postings.second);
+      }
+      index_ = std::vector<std::unordered_map<
+          std::uint64_t, std::pair<std::uint32_t, std::uint32_t>>>(
+          mapped_bins_);
+    }
+    mapping_.reset();
   }
-  for (auto& it : index_) {
-    it.clear();
+  if (!append) {
+    for (auto& it : minimizers_) {
+      it.clear();
+    }
+    for (auto& it : index_) {
+      it.clear();
+    }
   }
+  stats_ = Statistics{};
 
   if (begin >= end) {
     return;
   }
 
-  {
-    std::uint64_t bin_mask = minimizers_.size() - 1;
-
+  std::vector<std::vector<uint128_t>> sketches;
+  std::uint64_t num_minimizers = 0;
+  auto sketch = [&]() -> void {
+    sketches.clear();
+    num_minimizers = append ? GetMinimizerIndexSize() : 0;
     std::vector<std::future<std::vector<uint128_t>>> futures;
     for (auto it = begin; it != end; ++it) {
       futures.emplace_back(thread_pool_->Submit(
@@ -92,24 +447,159 @@ void MinimizerEngine::Minimize(
           it));
     }
     for (auto& it : futures) {
-      for (const auto& jt : it.get()) {
-        minimizers_[jt.first & bin_mask].emplace_back(jt);
-      }
+      sketches.emplace_back(it.get());
+      num_minimizers += sketches.back().size();
+    }
+  };
+
+  if (downweight_frequency_ > 0. && !append) {  // count unweighted kmers
+    downweight_.clear();
+    sketch();
+    BuildDownweight(sketches);
+  }
+  sketch();
+
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> targets;
+  for (auto it = begin; it != end; ++it) {
+    targets.emplace_back((*it)->id, (*it)->data.size());
+  }
+  AddTargets(std::move(targets), append);
+
+  // keep roughly kBinSize minimizers per bin, never shrink a filled index
+  const std::uint64_t kBinSize = 1ULL << 12;
+  const std::uint64_t kMaxBins = 1ULL << std::min(20U, 2 * k_);
+  std::uint64_t num_bins = 1;
+  while (num_bins < kMaxBins && num_bins * kBinSize < num_minimizers) {
+    num_bins <<= 1;
+  }
+  if (append) {
+    num_bins = std::max<std::uint64_t>(num_bins, minimizers_.size());
+  }
+
+  std::vector<std::uint8_t> is_dirty(num_bins, 0);
+  if (num_bins != minimizers_.size() || is_attached) {
+    if (num_bins != minimizers_.size()) {
+      Repartition(num_bins);
+    }
+    for (std::uint64_t i = 0; i < num_bins; ++i) {
+      is_dirty[i] = !minimizers_[i].empty();
     }
   }
 
+  {  // fill bins in parallel so that index pages are first touched (and
+     // placed, see Placement) by pool threads instead of the calling thread
+    std::uint64_t bin_mask = num_bins - 1;
+    std::uint64_t num_tasks = std::min<std::uint64_t>(
+        sketches.size(), thread_pool_->num_threads());
+    std::uint64_t sketches_per_task =
+        (sketches.size() + num_tasks - 1) / num_tasks;
+    std::uint64_t bins_per_task = (num_bins + num_tasks - 1) / num_tasks;
+
+    // offsets[t][bin] = number, later position, of task t minimizers in bin
+    std::vector<std::vector<std::uint64_t>> offsets(num_tasks);
+
+    auto for_each_task = [&](std::function<void(std::uint64_t)> task) {
+      std::vector<std::future<void>> futures;
+      for (std::uint64_t t = 0; t < num_tasks; ++t) {
+        futures.emplace_back(thread_pool_->Submit(task, t));
+      }
+      for (const auto& it : futures) {
+        it.wait();
+      }
+    };
+
+    for_each_task([&](std::uint64_t t) -> void {
+      offsets[t].resize(num_bins, 0);
+      std::uint64_t end =
+          std::min<std::uint64_t>((t + 1) * sketches_per_task, sketches.size());
+      for (std::uint64_t i = t * sketches_per_task; i < end; ++i) {
+        for (const auto& it : sketches[i]) {
+          ++offsets[t][it.first & bin_mask];
+        }
+      }
+    });
+
+    for_each_task([&](std::uint64_t t) -> void {
+      numa::InterleaveScope interleave{interleave_nodes_};
+      std::uint64_t end = std::min<std::uint64_t>((t + 1) * bins_per_task,
+                                                  num_bins);
+      for (std::uint64_t bin = t * bins_per_task; bin < end; ++bin) {
+        std::uint64_t size = minimizers_[bin].size();
+        for (auto& it : offsets) {
+          std::swap(it[bin], size);
+          size += it[bin];
+        }
+        if (size != minimizers_[bin].size()) {
+          minimizers_[bin].resize(size);
+          is_dirty[bin] = 1;
+        }
+      }
+    });
+
+    for_each_task([&](std::uint64_t t) -> void {
+      std::uint64_t end =
+          std::min<std::uint64_t>((t + 1) * sketches_per_task, sketches.size());
+      for (std::uint64_t i = t * sketches_per_task; i < end; ++i) {
+        for (const auto& it : sketches[i]) {
+          std::uint64_t bin = it.first & bin_mask;
+          minimizers_[bin][offsets[t][bin]++] = it;
+        }
+        std::vector<uint128_t>().swap(sketches[i]);
+      }
+    });
+  }
+
   {
     std::vector<std::future<void>> futures;
     for (std::uint32_t i = 0; i < minimizers_.size(); ++i) {
-      if (minimizers_[i].empty()) {
+      if (!is_dirty[i]) {
         continue;
       }
 
       futures.emplace_back(thread_pool_->Submit(
           [&](std::uint32_t bin) -> void {
+            numa::InterleaveScope interleave{interleave_nodes_};
             RadixSort(minimizers_[bin].begin(), minimizers_[bin].end(), k_ * 2,
                       ::First);
 
+            // postings of a kmer are ordered by id (see Map)
+            for (std::uint64_t i = 0, j = 1; i < minimizers_[bin].size();
+                 i = j++) {
+              while (j < minimizers_[bin].size() &&
+                     minimizers_[bin][j].first == minimizers_[bin][i].first) {
+                ++j;
+              }
+              auto by_id = [](const uint128_t& lhs,
+                              const uint128_t& rhs) -> bool {
+                return (lhs.second >> 32) < (rhs.second >> 32);
+              };
+              if (!std::is_sorted(minimizers_[bin].begin() + i,
+                                  minimizers_[bin].begin() + j, by_id)) {
+                std::stable_sort(minimizers_[bin].begin() + i,
+                                 minimizers_[bin].begin() + j, by_id);
+              }
+            }
+
+            if (max_postings_) {  // drop kmers with too many postings
+              auto& postings = minimizers_[bin];
+              std::uint64_t n = 0;
+              for (std::uint64_t i = 0, j = 1; i < postings.size(); i = j++) {
+                while (j < postings.size() &&
+                       postings[j].first == postings[i].first) {
+                  ++j;
+                }
+                if (j - i <= max_postings_) {
+                  if (n != i) {
+                    std::move(postings.begin() + i, postings.begin() + j,
+                              postings.begin() + n);
+                  }
+                  n += j - i;
+                }
+              }
+              postings.resize(n);
+            }
+
+            index_[bin].clear();
             for (std::uint64_t i = 0, c = 0; i < minimizers_[bin].size(); ++i) {
               if (i > 0 && minimizers_[bin][i - 1].first !=
                                minimizers_[bin][i].first) {  // NOLINT
@@ -132,78 +622,688 @@ void MinimizerEngine::Minimize(
   }
 }
 
+void MinimizerEngine::Repartition(std::uint64_t num_bins) {
+  // postings keep their relative order, bins are sorted again by the caller
+  numa::InterleaveScope interleave{interleave_nodes_};
+  std::vector<std::vector<uint128_t>> minimizers(num_bins);
+  std::uint64_t bin_mask = num_bins - 1;
+  for (auto& it : minimizers_) {
+    for (const auto& jt : it) {
+      minimizers[jt.first & bin_mask].emplace_back(jt);
+    }
+    std::vector<uint128_t>().swap(it);
+  }
+  minimizers_.swap(minimizers);
+  index_ = std::vector<std::unordered_map<
+      std::uint64_t, std::pair<std::uint32_t, std::uint32_t>>>(num_bins);
+}
+
+void MinimizerEngine::AddTargets(
+    std::vector<std::pair<std::uint32_t, std::uint64_t>>&& targets,
+    bool append) {
+  if (!append) {
+    target_bases_.clear();
+  }
+  for (std::uint64_t i = 0; i + 1 < target_bases_.size(); ++i) {
+    target_bases_[i].second -= target_bases_[i + 1].second;  // to lengths
+  }
+  target_bases_.insert(target_bases_.end(), targets.begin(), targets.end());
+  std::sort(target_bases_.begin(), target_bases_.end());
+  for (std::uint64_t i = target_bases_.size(); i-- > 1;) {
+    target_bases_[i - 1].second += target_bases_[i].second;
+  }
+
+  if (skip_contained_) {  // grow the containment flags, keeping set ones
+    for (const auto& it : targets) {
+      if (it.first >= lengths_.size()) {
+        lengths_.resize(it.first + 1, 0);
+      }
+      lengths_[it.first] = it.second;
+    }
+    if (contained_.size() < lengths_.size()) {
+      std::vector<std::atomic<bool>> contained(lengths_.size());
+      for (std::uint64_t i = 0; i < contained_.size(); ++i) {
+        contained[i] = contained_[i].load();
+      }
+      contained_.swap(contained);
+    }
+  }
+}
+
+std::vector<std::pair<std::uint32_t, std::uint64_t>>
+MinimizerEngine::TargetLengths() const {
+  auto dst = target_bases_;
+  for (std::uint64_t i = 0; i + 1 < dst.size(); ++i) {
+    dst[i].second -= dst[i + 1].second;
+  }
+  return dst;
+}
+
 void MinimizerEngine::Filter(double frequency) {
   if (!(0 <= frequency && frequency <= 1)) {
     throw std::invalid_argument(
         "[ram::MinimizerEngine::Filter] error: invalid frequency");
   }
+  ClearCache();
+
+  // occurrences below kDense are counted in a histogram, rest are kept
+  const std::uint32_t kDense = 1U << 12;
+  struct Partial {
+    Statistics stats;
+    std::vector<std::uint64_t> dense;
+    std::vector<std::uint32_t> sparse;
+  };
 
-  if (frequency == 0) {
-    occurrence_ = -1;
-    return;
+  std::uint64_t num_bins = NumBins();
+  std::uint64_t num_tasks = std::min<std::uint64_t>(
+      num_bins, 4ULL * thread_pool_->num_threads());
+  std::uint64_t bins_per_task = (num_bins + num_tasks - 1) / num_tasks;
+
+  std::vector<std::future<Partial>> futures;
+  for (std::uint64_t i = 0; i < num_bins; i += bins_per_task) {
+    futures.emplace_back(thread_pool_->Submit(
+        [&](std::uint64_t begin, std::uint64_t end) -> Partial {
+          Partial dst;
+          dst.stats.histogram.resize(33, 0);
+          dst.dense.resize(kDense, 0);
+          for (std::uint64_t bin = begin; bin < end; ++bin) {
+            auto postings = Postings(bin);
+            dst.stats.num_minimizers += postings.second - postings.first;
+            if (!mapping_) {
+              dst.stats.num_bytes +=
+                  sizeof(minimizers_[bin]) + sizeof(index_[bin]) +
+                  minimizers_[bin].capacity() * sizeof(uint128_t) +
+                  index_[bin].bucket_count() * sizeof(void*) +
+                  index_[bin].size() *  // node with next pointer and hash
+                      (sizeof(*index_[bin].begin()) + 2 * sizeof(void*));
+            }
+            // postings are sorted by kmer, count the length of each run
+            for (auto it = postings.first; it != postings.second;) {
+              auto jt = it + 1;
+              while (jt != postings.second && jt->first == it->first) {
+                ++jt;
+              }
+              std::uint32_t occurrence = jt - it;
+              it = jt;
+
+              ++dst.stats.num_keys;
+              if (occurrence == 1) {
+                ++dst.stats.num_singletons;
+              }
+              std::uint32_t log = 0;
+              while (occurrence >> (log + 1)) {
+                ++log;
+              }
+              ++dst.stats.histogram[log];
+              if (occurrence < kDense) {
+                ++dst.dense[occurrence];
+              } else {
+                dst.sparse.emplace_back(occurrence);
+              }
+            }
+          }
+          return dst;
+        },
+        i, std::min<std::uint64_t>(i + bins_per_task, num_bins)));
   }
 
-  std::vector<std::uint32_t> occurrences;
-  for (const auto& it : index_) {
+  stats_ = Statistics{};
+  stats_.histogram.resize(33, 0);
+  stats_.num_bytes = mapping_ ? mapping_size_ : 0;
+  std::vector<std::uint64_t> dense(kDense, 0);
+  std::vector<std::uint32_t> sparse;
+  for (auto& it : futures) {
+    auto partial = it.get();
+    stats_.num_minimizers += partial.stats.num_minimizers;
+    stats_.num_keys += partial.stats.num_keys;
+    stats_.num_singletons += partial.stats.num_singletons;
+    stats_.num_bytes += partial.stats.num_bytes;
+    for (std::uint32_t i = 0; i < stats_.histogram.size(); ++i) {
+      stats_.histogram[i] += partial.stats.histogram[i];
+    }
+    for (std::uint32_t i = 0; i < kDense; ++i) {
+      dense[i] += partial.dense[i];
+    }
+    sparse.insert(sparse.end(), partial.sparse.begin(), partial.sparse.end());
+  }
+  while (stats_.histogram.size() > 1 && stats_.histogram.back() == 0) {
+    stats_.histogram.pop_back();
+  }
+
+  occurrence_ = -1;
+  if (frequency != 0 && stats_.num_keys != 0) {
+    // occurrence at position (1 - frequency) * num_keys in sorted order
+    std::uint64_t rank = (1 - frequency) * stats_.num_keys;
+    std::uint32_t i = 0;
+    for (; i < kDense && rank >= dense[i]; ++i) {
+      rank -= dense[i];
+    }
+    if (i < kDense) {
+      occurrence_ = i + 1;
+    } else {
+      std::nth_element(sparse.begin(), sparse.begin() + rank, sparse.end());
+      occurrence_ = sparse[rank] + 1;
+    }
+  }
+  stats_.occurrence = occurrence_;
+
+  BuildPrefilter();
+  stats_.num_bytes += prefilter_.size() * sizeof(std::uint64_t);
+}
+
+void MinimizerEngine::BuildPrefilter() {
+  // blocked Bloom filter, about 8 bits per key and all probes of a key
+  // within one 512 bit block
+  std::uint64_t num_blocks = 1;
+  while (num_blocks * 64 < stats_.num_keys && num_blocks < (1ULL << 28)) {
+    num_blocks <<= 1;
+  }
+  std::vector<std::atomic<std::uint64_t>> prefilter;
+  {
+    numa::InterleaveScope interleave{interleave_nodes_};
+    std::vector<std::atomic<std::uint64_t>>(num_blocks * 8).swap(prefilter);
+  }
+  prefilter_.swap(prefilter);
+  prefilter_mask_ = num_blocks - 1;
+
+  std::uint64_t num_bins = NumBins();
+  std::uint64_t num_tasks = std::min<std::uint64_t>(
+      num_bins, 4ULL * thread_pool_->num_threads());
+  std::uint64_t bins_per_task = (num_bins + num_tasks - 1) / num_tasks;
+
+  std::vector<std::future<void>> futures;
+  for (std::uint64_t i = 0; i < num_bins; i += bins_per_task) {
+    futures.emplace_back(thread_pool_->Submit(
+        [&](std::uint64_t begin, std::uint64_t end) -> void {
+          for (std::uint64_t bin = begin; bin < end; ++bin) {
+            auto postings = Postings(bin);
+            for (auto it = postings.first; it != postings.second;) {
+              auto jt = it + 1;
+              while (jt != postings.second && jt->first == it->first) {
+                ++jt;
+              }
+              if (static_cast<std::uint64_t>(jt - it) <= occurrence_) {
+                std::uint64_t hash = Hash(it->first, -1);
+                auto block = prefilter_.begin() +
+                             ((hash >> 36) & prefilter_mask_) * 8;
+                for (std::uint32_t k = 0; k < 4; ++k, hash >>= 9) {
+                  block[(hash >> 6) & 7].fetch_or(
+                      1ULL << (hash & 63), std::memory_order_relaxed);
+                }
+              }
+              it = jt;
+            }
+          }
+        },
+        i, std::min<std::uint64_t>(i + bins_per_task, num_bins)));
+  }
+  for (const auto& it : futures) {
+    it.wait();
+  }
+}
+
+void MinimizerEngine::BuildDownweight(
+    const std::vector<std::vector<uint128_t>>& sketches) {
+  std::vector<std::uint64_t> kmers;
+  for (const auto& it : sketches) {
     for (const auto& jt : it) {
-      occurrences.emplace_back(jt.second.second);
+      kmers.emplace_back(jt.first);
     }
   }
+  RadixSort(kmers.begin(), kmers.end(), k_ * 2,
+            [](std::uint64_t kmer) -> std::uint64_t { return kmer; });
 
+  std::vector<std::uint32_t> occurrences;
+  for (std::uint64_t i = 0, j = 1; i < kmers.size(); i = j++) {
+    while (j < kmers.size() && kmers[j] == kmers[i]) {
+      ++j;
+    }
+    occurrences.emplace_back(j - i);
+  }
   if (occurrences.empty()) {
-    occurrence_ = -1;
     return;
   }
 
-  std::nth_element(occurrences.begin(),
-                   occurrences.begin() + (1 - frequency) * occurrences.size(),
-                   occurrences.end());
-  occurrence_ = occurrences[(1 - frequency) * occurrences.size()] + 1;
+  // kmers occurring more often than the one at (1 - frequency) * num_keys
+  std::uint64_t rank = std::min<std::uint64_t>(
+      (1 - downweight_frequency_) * occurrences.size(), occurrences.size() - 1);
+  auto sorted = occurrences;
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  std::uint32_t threshold = std::max(sorted[rank], 1U);
+
+  std::uint64_t num_frequent = 0;
+  for (const auto& it : occurrences) {
+    num_frequent += it > threshold;
+  }
+  if (num_frequent == 0) {
+    return;
+  }
+
+  // one bit per kmer in 64 per frequent kmer, about 1.5 % false positives
+  std::uint64_t num_words = 1;
+  while (num_words < num_frequent) {
+    num_words <<= 1;
+  }
+  downweight_.assign(num_words, 0);
+  downweight_mask_ = num_words - 1;
+  for (std::uint64_t i = 0, j = 0; j < occurrences.size(); ++j) {
+    if (occurrences[j] > threshold) {
+      downweight_[(kmers[i] >> 6) & downweight_mask_] |=
+          1ULL << (kmers[i] & 63);
+    }
+    i += occurrences[j];
+  }
+}
+
+bool MinimizerEngine::MayContain(std::uint64_t kmer) const {
+  if (prefilter_.empty()) {
+    return true;
+  }
+  std::uint64_t hash = Hash(kmer, -1);
+  auto block = prefilter_.begin() + ((hash >> 36) & prefilter_mask_) * 8;
+  for (std::uint32_t k = 0; k < 4; ++k, hash >>= 9) {
+    if (!(block[(hash >> 6) & 7].load(std::memory_order_relaxed) &
+          (1ULL << (hash & 63)))) {
+      return false;
+    }
+  }
+  return true;
 }
 
 std::vector<biosoup::Overlap> MinimizerEngine::Map(
     const std::unique_ptr<biosoup::Sequence>& sequence, bool avoid_equal,
     bool avoid_symmetric, bool micromize, double micromize_factor,
     std::uint8_t N) const {
+  // results of duplicate reads are shared unless they depend on the lhs id;
+  // only the same orientation, hits are equal to mapping the read again
+  // (reverse complements would differ by a few bases at the chain ends)
+  bool is_cached = !cache_.empty() && !avoid_equal && !avoid_symmetric;
+  uint128_t key;
+  if (is_cached) {
+    std::uint64_t factor;
+    std::memcpy(&factor, &micromize_factor, sizeof(factor));
+    key = SequenceHash(sequence->data, factor ^ (micromize << 8) ^ N);
+
+    auto& shard = *cache_[key.first % kCacheShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key.first);
+    if (it != shard.entries.end() && it->second.first == key.second) {
+      auto dst = it->second.second;
+      for (auto& jt : dst) {
+        jt.lhs_id = sequence->id;
+      }
+      return dst;
+    }
+  }
+
+  bool is_contained = skip_contained_ && avoid_equal;
+  if (is_contained && IsFlagged(sequence->id)) {
+    return std::vector<biosoup::Overlap>{};
+  }
+
+  auto dst = MapSketch(sequence, avoid_equal, avoid_symmetric, micromize,
+                       micromize_factor, N);
+  if (is_contained) {
+    FlagContained(sequence, &dst);
+  }
+  if (is_cached) {
+    auto overlaps = dst;
+    auto& shard = *cache_[key.first % kCacheShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.entries.emplace(key.first, std::make_pair(key.second,
+                                                        std::move(overlaps)))
+            .second) {
+      shard.order.emplace_back(key.first);
+      if (shard.order.size() > cache_capacity_) {
+        shard.entries.erase(shard.order.front());
+        shard.order.pop_front();
+      }
+    }
+  }
+  return dst;
+}
+
+std::vector<biosoup::Overlap> MinimizerEngine::MapSketch(
+    const std::unique_ptr<biosoup::Sequence>& sequence, bool avoid_equal,
+    bool avoid_symmetric, bool micromize, double micromize_factor,
+    std::uint8_t N) const {
   auto sketch = Minimize(sequence, micromize, micromize_factor, N);
   if (sketch.empty()) {
     return std::vector<biosoup::Overlap>{};
   }
 
-  std::uint64_t bin_mask = minimizers_.size() - 1;
-  std::vector<uint128_t> matches;
-  for (const auto& it : sketch) {
-    std::uint32_t bin = it.first & bin_mask;
-    auto match = index_[bin].find(it.first);
-    if (match == index_[bin].end() || match->second.second > occurrence_) {
+  std::vector<std::uint32_t> groups;
+  std::vector<std::uint64_t> anchors;
+  Collect(&sketch, sequence->id, avoid_equal, avoid_symmetric, {}, &groups,
+          &anchors);
+  return Chain(sequence->id, std::move(groups), std::move(anchors));
+}
+
+bool MinimizerEngine::IsFlagged(std::uint64_t id) const {
+  return id < contained_.size() &&
+         contained_[id].load(std::memory_order_relaxed);
+}
+
+void MinimizerEngine::FlagContained(
+    const std::unique_ptr<biosoup::Sequence>& sequence,
+    std::vector<biosoup::Overlap>* overlaps) const {
+  // the shorter side is contained, ties go to lower ids
+  std::uint32_t lhs_len = sequence->data.size();
+  for (const auto& it : *overlaps) {
+    if (it.rhs_id >= lengths_.size() || lengths_[it.rhs_id] == 0) {
+      continue;
+    }
+    std::uint32_t rhs_len = lengths_[it.rhs_id];
+    if (lhs_len < rhs_len || (lhs_len == rhs_len && it.lhs_id > it.rhs_id)) {
+      if (::IsContained(it.lhs_begin, it.lhs_end, lhs_len)) {
+        if (it.lhs_id < contained_.size()) {
+          contained_[it.lhs_id].store(true, std::memory_order_relaxed);
+        }
+        overlaps->clear();
+        return;
+      }
+    } else if (::IsContained(it.rhs_begin, it.rhs_end, rhs_len)) {
+      contained_[it.rhs_id].store(true, std::memory_order_relaxed);
+    }
+  }
+  overlaps->erase(std::remove_if(overlaps->begin(), overlaps->end(),
+                                 [&](const biosoup::Overlap& it) -> bool {
+                                   return IsFlagged(it.rhs_id);
+                                 }),
+                  overlaps->end());
+}
+
+void MinimizerEngine::Collect(std::vector<uint128_t>* sketch,
+                              std::uint64_t lhs_id, bool avoid_equal,
+                              bool avoid_symmetric,
+                              const std::vector<std::uint32_t>& targets,
+                              std::vector<std::uint32_t>* groups,
+                              std::vector<std::uint64_t>* anchors) const {
+  PerfCounters::Scope scope{PerfCounters::kLookup};
+  // group equal kmers so that each one is looked up once, Chain sorts the
+  // matches afterwards hence their order does not matter
+  RadixSort(sketch->begin(), sketch->end(), k_ * 2, ::First);
+
+  const auto& lhs = *sketch;
+  for (std::uint64_t i = 0, j = 1; i < lhs.size(); i = j++) {
+    while (j < lhs.size() && lhs[j].first == lhs[i].first) {
+      ++j;
+    }
+
+    if (!MayContain(lhs[i].first)) {
+      continue;
+    }
+    auto match = Lookup(lhs[i].first);
+    if (match.first == match.second ||
+        static_cast<std::uint64_t>(match.second - match.first) > occurrence_) {
       continue;
     }
 
-    auto jt = minimizers_[bin].begin() + match->second.first;
-    auto end = jt + match->second.second;
+    auto jt = match.first;
+    auto end = match.second;
+    if (avoid_symmetric) {  // skip postings with rhs_id < lhs_id
+      jt = std::lower_bound(
+          jt, end, lhs_id,
+          [](const uint128_t& posting, std::uint64_t id) -> bool {
+            return (posting.second >> 32) < id;
+          });
+    }
     for (; jt != end; ++jt) {
       std::uint64_t rhs_id = jt->second >> 32;
-      if (avoid_equal && static_cast<std::uint64_t>(sequence->id) == rhs_id) {
+      if (avoid_equal && lhs_id == rhs_id) {
         continue;
       }
-      if (avoid_symmetric &&
-          static_cast<std::uint64_t>(sequence->id) > rhs_id) {  // NOLINT
+      if (!targets.empty() &&
+          !std::binary_search(targets.begin(), targets.end(), rhs_id)) {
         continue;
       }
 
-      std::uint64_t strand = (it.second & 1) == (jt->second & 1);
-      std::uint64_t lhs_pos = it.second << 32 >> 33;
       std::uint64_t rhs_pos = jt->second << 32 >> 33;
+      for (auto it = lhs.begin() + i; it != lhs.begin() + j; ++it) {
+        std::uint64_t strand = (it->second & 1) == (jt->second & 1);
+        std::uint64_t lhs_pos = it->second << 32 >> 33;
+
+        std::uint64_t diagonal =
+            !strand ? rhs_pos + lhs_pos : rhs_pos - lhs_pos + (3ULL << 30);
+
+        groups->emplace_back((rhs_id << 1) | strand);
+        anchors->emplace_back((diagonal << 32) | lhs_pos);
+      }
+    }
+  }
+}
+
+std::vector<biosoup::Overlap> MinimizerEngine::MapCoarseToFine(
+    const std::unique_ptr<biosoup::Sequence>& sequence, bool avoid_equal,
+    bool avoid_symmetric, double coarse_factor) const {
+  bool is_contained = skip_contained_ && avoid_equal;
+  if (is_contained && IsFlagged(sequence->id)) {
+    return std::vector<biosoup::Overlap>{};
+  }
+
+  std::vector<std::uint32_t> groups;
+  std::vector<std::uint64_t> anchors;
+
+  auto sketch = Minimize(sequence, true, coarse_factor);
+  Collect(&sketch, sequence->id, avoid_equal, avoid_symmetric, {}, &groups,
+          &anchors);
+  auto coarse = Chain(sequence->id, std::move(groups), std::move(anchors));
+
+  // a placement is unambiguous if it scores twice as high as any other
+  std::vector<std::uint32_t> targets;
+  std::uint32_t best = 0, second = 0;
+  for (const auto& it : coarse) {
+    targets.emplace_back(it.rhs_id);
+    if (it.score > best) {
+      second = best;
+      best = it.score;
+    } else if (it.score > second) {
+      second = it.score;
+    }
+  }
+  if (!coarse.empty() && best >= 2 * second) {
+    if (is_contained) {
+      FlagContained(sequence, &coarse);
+    }
+    return coarse;
+  }
+
+  // ambiguous reads are remapped with the dense sketch against the targets
+  // found above (or against all of them if none was)
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+  groups.clear();
+  anchors.clear();
+  sketch = Minimize(sequence);
+  if (sketch.empty()) {
+    return std::vector<biosoup::Overlap>{};
+  }
+  Collect(&sketch, sequence->id, avoid_equal, avoid_symmetric, targets,
+          &groups, &anchors);
+  auto dst = Chain(sequence->id, std::move(groups), std::move(anchors));
+  if (is_contained) {
+    FlagContained(sequence, &dst);
+  }
+  return dst;
+}
+
+std::vector<biosoup::Overlap> MinimizerEngine::Map(
+    const std::unique_ptr<biosoup::Sequence>& sequence,
+    const MapOptions& options) const {
+  if (options.K) {
+    return MapBeginEnd(sequence, options.avoid_equal, options.avoid_symmetric,
+                       options.K);
+  }
+  if (options.coarse_factor > 0.) {
+    return MapCoarseToFine(sequence, options.avoid_equal,
+                           options.avoid_symmetric, options.coarse_factor);
+  }
+  return Map(sequence, options.avoid_equal, options.avoid_symmetric,
+             options.micromize, options.micromize_factor, options.N);
+}
+
+double MinimizerEngine::MapCost(
+    const std::unique_ptr<biosoup::Sequence>& sequence,
+    const MapOptions& options) const {
+  double dst = sequence->data.size();
+  if (options.avoid_symmetric && !target_bases_.empty()) {
+    auto it = std::lower_bound(
+        target_bases_.begin(), target_bases_.end(),
+        std::make_pair(sequence->id, static_cast<std::uint64_t>(0)));
+    dst *= it == target_bases_.end()
+               ? 0.
+               : it->second / static_cast<double>(target_bases_[0].second);
+  }
+  return dst;
+}
 
-      std::uint64_t diagonal =
-          !strand ? rhs_pos + lhs_pos : rhs_pos - lhs_pos + (3ULL << 30);
+std::future<void> MinimizerEngine::MapBatch(
+    std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator begin,
+    std::vector<std::unique_ptr<biosoup::Sequence>>::const_iterator end,
+    const MapOptions& options, MapCallback callback) const {
+  struct Batch {
+    std::vector<std::uint64_t> order;  // most expensive first
+    std::atomic<std::uint64_t> next{0};
+    std::atomic<std::uint32_t> num_workers{0};
+    std::mutex mutex;
+    std::exception_ptr exception;
+    std::promise<void> done;
+  };
+  auto batch = std::make_shared<Batch>();
+  auto dst = batch->done.get_future();
 
-      matches.emplace_back((((rhs_id << 1) | strand) << 32) | diagonal,
-                           (lhs_pos << 32) | rhs_pos);
+  std::vector<double> costs;
+  for (auto it = begin; it != end; ++it) {
+    costs.emplace_back(MapCost(*it, options));
+  }
+  batch->order.resize(end - begin);
+  std::iota(batch->order.begin(), batch->order.end(), 0);
+  std::stable_sort(batch->order.begin(), batch->order.end(),
+                   [&](std::uint64_t lhs, std::uint64_t rhs) -> bool {
+                     return costs[lhs] > costs[rhs];
+                   });
+  if (batch->order.empty()) {
+    batch->done.set_value();
+    return dst;
+  }
+
+  // one worker per thread pulls sequences until none are left, hence
+  // sequences are not queued ahead of the callbacks
+  std::uint32_t num_workers = std::min<std::uint64_t>(
+      thread_pool_->num_threads(), batch->order.size());
+  batch->num_workers = num_workers;
+  for (std::uint32_t i = 0; i < num_workers; ++i) {
+    thread_pool_->Submit([this, batch, begin, options, callback]() -> void {
+      for (std::uint64_t j; (j = batch->next++) < batch->order.size();) {
+        try {
+          const auto& sequence = begin[batch->order[j]];
+          callback(sequence, Map(sequence, options));
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(batch->mutex);
+          if (!batch->exception) {
+            batch->exception = std::current_exception();
+          }
+          batch->next = batch->order.size();
+        }
+      }
+      if (--batch->num_workers == 0) {
+        if (batch->exception) {
+          batch->done.set_exception(batch->exception);
+        } else {
+          batch->done.set_value();
+        }
+      }
+    });
+  }
+  return dst;
+}
+
+void MinimizerEngine::Align(const std::unique_ptr<biosoup::Sequence>& lhs,
+                            const std::unique_ptr<biosoup::Sequence>& rhs,
+                            biosoup::Overlap* overlap) const {
+  if (overlap->lhs_end > lhs->data.size() ||
+      overlap->rhs_end > rhs->data.size() ||
+      overlap->lhs_begin >= overlap->lhs_end ||
+      overlap->rhs_begin >= overlap->rhs_end) {
+    throw std::invalid_argument(
+        "[ram::MinimizerEngine::Align] error: overlap out of bounds");
+  }
+  overlap->alignment.clear();  // left empty if a gap is too big to align
+
+  // both segments in lhs orientation (ids are not counted as new objects)
+  std::unique_ptr<biosoup::Sequence> l{new biosoup::Sequence(
+      lhs->id, lhs->name,
+      lhs->data.substr(overlap->lhs_begin,
+                       overlap->lhs_end - overlap->lhs_begin))};
+  std::unique_ptr<biosoup::Sequence> r{new biosoup::Sequence(
+      rhs->id, rhs->name,
+      rhs->data.substr(overlap->rhs_begin,
+                       overlap->rhs_end - overlap->rhs_begin))};
+  if (!overlap->strand) {
+    for (auto& it : r->data) {
+      it = ::Complement(it);
     }
+    std::reverse(r->data.begin(), r->data.end());
   }
 
-  return Chain(sequence->id, std::move(matches));
+  // matching minimizers of the segments are the chain anchors, their
+  // longest colinear subset splits the alignment into short gaps
+  auto lhs_sketch = Minimize(l);
+  auto rhs_sketch = Minimize(r);
+  RadixSort(lhs_sketch.begin(), lhs_sketch.end(), k_ * 2, ::First);
+  RadixSort(rhs_sketch.begin(), rhs_sketch.end(), k_ * 2, ::First);
+
+  std::vector<std::uint64_t> anchors;
+  for (std::uint64_t i = 0, j = 0; i < lhs_sketch.size(); ++i) {
+    while (j < rhs_sketch.size() && rhs_sketch[j].first < lhs_sketch[i].first) {
+      ++j;
+    }
+    for (std::uint64_t k = j; k < rhs_sketch.size() &&
+                              rhs_sketch[k].first == lhs_sketch[i].first;
+         ++k) {
+      if ((lhs_sketch[i].second & 1) != (rhs_sketch[k].second & 1)) {
+        continue;
+      }
+      std::uint64_t lhs_pos = lhs_sketch[i].second << 32 >> 33;
+      std::uint64_t rhs_pos = rhs_sketch[k].second << 32 >> 33;
+      anchors.emplace_back(((rhs_pos - lhs_pos + (3ULL << 30)) << 32) |
+                           lhs_pos);
+    }
+  }
+  RadixSort(anchors.begin(), anchors.end(), 32, ::LhsPos);
+  auto indices = LongestSubsequence(anchors.begin(), anchors.end(), 1,
+                                    std::less<std::uint64_t>());
+
+  std::string ops;
+  std::uint32_t lhs_pos = 0, rhs_pos = 0;
+  for (const auto& it : indices) {
+    std::uint32_t lhs_next = ::LhsPos(anchors[it]);
+    std::uint32_t rhs_next = ::RhsPos(anchors[it], 1);
+    if (lhs_next < lhs_pos || rhs_next < rhs_pos) {
+      continue;
+    }
+    if (!AlignSegment(&l->data[lhs_pos], lhs_next - lhs_pos,
+                      &r->data[rhs_pos], rhs_next - rhs_pos, &ops)) {
+      return;
+    }
+    lhs_pos = lhs_next;
+    rhs_pos = rhs_next;
+  }
+  if (!AlignSegment(&l->data[lhs_pos], l->data.size() - lhs_pos,
+                    &r->data[rhs_pos], r->data.size() - rhs_pos, &ops)) {
+    return;
+  }
+  if (!overlap->strand) {  // CIGAR of reverse complemented lhs and rhs
+    std::reverse(ops.begin(), ops.end());
+  }
+
+  for (std::uint64_t i = 0, j = 1; i < ops.size(); i = j++) {
+    while (j < ops.size() && ops[j] == ops[i]) {
+      ++j;
+    }
+    overlap->alignment += std::to_string(j - i) + ops[i];
+  }
 }
 
 std::vector<biosoup::Overlap> MinimizerEngine::Map(
@@ -225,7 +1325,8 @@ std::vector<biosoup::Overlap> MinimizerEngine::Map(
 
   std::uint64_t rhs_id = rhs->id;
 
-  std::vector<uint128_t> matches;
+  std::vector<std::uint32_t> groups;
+  std::vector<std::uint64_t> anchors;
   for (std::uint32_t i = 0, j = 0; i < lhs_sketch.size(); ++i) {
     while (j < rhs_sketch.size()) {
       if (lhs_sketch[i].first < rhs_sketch[j].first) {
@@ -243,8 +1344,8 @@ std::vector<biosoup::Overlap> MinimizerEngine::Map(
           std::uint64_t diagonal =
               !strand ? rhs_pos + lhs_pos : rhs_pos - lhs_pos + (3ULL << 30);
 
-          matches.emplace_back((((rhs_id << 1) | strand) << 32) | diagonal,
-                               (lhs_pos << 32) | rhs_pos);
+          groups.emplace_back((rhs_id << 1) | strand);
+          anchors.emplace_back((diagonal << 32) | lhs_pos);
         }
         break;
       } else {
@@ -253,63 +1354,131 @@ std::vector<biosoup::Overlap> MinimizerEngine::Map(
     }
   }
 
-  return Chain(lhs->id, std::move(matches));
+  return Chain(lhs->id, std::move(groups), std::move(anchors));
 }
 
 std::vector<biosoup::Overlap> MinimizerEngine::Chain(
-    std::uint64_t lhs_id, std::vector<uint128_t>&& matches) const {
-  RadixSort(matches.begin(), matches.end(), 64, ::First);
-  matches.emplace_back(-1, -1);  // stop dummy
-
-  std::vector<uint128_t> intervals;
-  for (std::uint64_t i = 1, j = 0; i < matches.size(); ++i) {  // NOLINT
-    if (matches[i].first - matches[j].first > 500) {
-      if (i - j >= n_) {
-        if (!intervals.empty() && intervals.back().second > j) {  // extend
-          intervals.back().second = i;
-        } else {  // new
-          intervals.emplace_back(j, i);
-        }
+    std::uint64_t lhs_id, std::vector<std::uint32_t>&& groups,
+    std::vector<std::uint64_t>&& anchors) const {
+  PerfCounters::Scope scope{PerfCounters::kChain};
+  std::vector<biosoup::Overlap> dst;
+  if (anchors.empty()) {
+    return dst;
+  }
+
+  {  // group anchors by (rhs_id, strand) using only the occupied bits
+    auto minmax = std::minmax_element(groups.begin(), groups.end());
+    std::uint32_t min_group = *minmax.first;
+    std::uint8_t max_bits = Bits(*minmax.second - min_group);
+
+    std::vector<std::uint32_t> groups_buffer(max_bits ? groups.size() : 0);
+    std::vector<std::uint64_t> anchors_buffer(max_bits ? anchors.size() : 0);
+    for (std::uint8_t shift = 0; shift < max_bits; shift += 8) {
+      std::uint64_t buckets[0x100]{};
+      for (const auto& it : groups) {
+        ++buckets[(it - min_group) >> shift & 0xFF];
       }
-      ++j;
-      while (j < i && matches[i].first - matches[j].first > 500) {
-        ++j;
+      for (std::uint64_t i = 0, j = 0; i < 0x100; ++i) {
+        std::swap(buckets[i], j);
+        j += buckets[i];
       }
+      for (std::uint64_t i = 0; i < groups.size(); ++i) {
+        auto& bucket = buckets[(groups[i] - min_group) >> shift & 0xFF];
+        groups_buffer[bucket] = groups[i];
+        anchors_buffer[bucket++] = anchors[i];
+      }
+      groups.swap(groups_buffer);
+      anchors.swap(anchors_buffer);
     }
   }
 
-  std::vector<biosoup::Overlap> dst;
-  for (const auto& it : intervals) {
-    std::uint64_t j = it.first;
-    std::uint64_t i = it.second;
-
-    if (i - j < n_) {
-      continue;
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> intervals;
+  for (std::uint64_t b = 0, e = 1; b < anchors.size(); b = e++) {
+    while (e < anchors.size() && groups[e] == groups[b]) {
+      ++e;
     }
 
-    RadixSort(matches.begin() + j, matches.begin() + i, 64, ::Second);
+    std::uint64_t rhs_id = groups[b] >> 1;
+    std::uint64_t strand = groups[b] & 1;
 
-    std::uint64_t strand = matches[j].first >> 32 & 1;
-
-    std::vector<std::uint64_t> indices;
-    if (strand) {                    // same strand
-      indices = LongestSubsequence(  // increasing
-          matches.begin() + j, matches.begin() + i, std::less<std::uint64_t>());
-    } else {                         // different strand
-      indices = LongestSubsequence(  // decreasing
-          matches.begin() + j, matches.begin() + i,
-          std::greater<std::uint64_t>());
+    {
+      std::uint64_t min_diagonal = -1, max_diagonal = 0;
+      for (auto it = anchors.begin() + b; it != anchors.begin() + e; ++it) {
+        min_diagonal = std::min(min_diagonal, ::Diagonal(*it));
+        max_diagonal = std::max(max_diagonal, ::Diagonal(*it));
+      }
+      RadixSort(anchors.begin() + b, anchors.begin() + e,
+                Bits(max_diagonal - min_diagonal),
+                [&](std::uint64_t anchor) -> std::uint64_t {
+                  return ::Diagonal(anchor) - min_diagonal;
+                });
     }
 
-    if (indices.size() < n_) {
-      continue;
+    auto is_far = [&](std::uint64_t i, std::uint64_t j) -> bool {
+      return i == e ||  // stop dummy
+             ::Diagonal(anchors[i]) - ::Diagonal(anchors[j]) > 500;
+    };
+
+    intervals.clear();
+    for (std::uint64_t i = b + 1, j = b; i <= e; ++i) {  // NOLINT
+      if (is_far(i, j)) {
+        if (i - j >= n_) {
+          if (!intervals.empty() && intervals.back().second > j) {  // extend
+            intervals.back().second = i;
+          } else {  // new
+            intervals.emplace_back(j, i);
+          }
+        }
+        ++j;
+        while (j < i && is_far(i, j)) {
+          ++j;
+        }
+      }
     }
 
-    indices.emplace_back(matches.size() - 1 - j);  // stop dummy from above
-    for (std::uint64_t k = 1, l = 0; k < indices.size(); ++k) {
-      if ((matches[j + indices[k]].second >> 32) -
-              (matches[j + indices[k - 1]].second >> 32) >
-          g_) {
+    for (const auto& it : intervals) {
+      std::uint64_t j = it.first;
+      std::uint64_t i = it.second;
+
+      if (i - j < n_) {
+        continue;
+      }
+
+      {  // anchors are ordered by diagonal, hence by rhs_pos within lhs_pos
+        std::uint64_t max_lhs_pos = 0;
+        for (auto jt = anchors.begin() + j; jt != anchors.begin() + i; ++jt) {
+          max_lhs_pos = std::max(max_lhs_pos, ::LhsPos(*jt));
+        }
+        RadixSort(anchors.begin() + j, anchors.begin() + i, Bits(max_lhs_pos),
+                  ::LhsPos);
+      }
+
+      std::vector<std::uint64_t> indices;
+      if (strand) {                    // same strand
+        indices = LongestSubsequence(  // increasing
+            anchors.begin() + j, anchors.begin() + i, strand,
+            std::less<std::uint64_t>());
+      } else {                         // different strand
+        indices = LongestSubsequence(  // decreasing
+            anchors.begin() + j, anchors.begin() + i, strand,
+            std::greater<std::uint64_t>());
+      }
+
+      if (indices.size() < n_) {
+        continue;
+      }
+
+      auto lhs_pos = [&](std::uint64_t k) -> std::uint32_t {
+        return ::LhsPos(anchors[j + indices[k]]);
+      };
+      auto rhs_pos = [&](std::uint64_t k) -> std::uint32_t {
+        return ::RhsPos(anchors[j + indices[k]], strand);
+      };
+
+      for (std::uint64_t k = 1, l = 0; k <= indices.size(); ++k) {
+        if (k < indices.size() && lhs_pos(k) - lhs_pos(k - 1) <= g_) {
+          continue;
+        }
         if (k - l < n_) {
           l = k;
           continue;
@@ -323,20 +1492,20 @@ std::vector<biosoup::Overlap> MinimizerEngine::Chain(
         std::uint32_t rhs_end = 0;
 
         for (std::uint64_t m = l; m < k; ++m) {
-          std::uint32_t lhs_pos = matches[j + indices[m]].second >> 32;
-          if (lhs_pos > lhs_end) {
+          std::uint32_t lhs = lhs_pos(m);
+          if (lhs > lhs_end) {
             lhs_matches += lhs_end - lhs_begin;
-            lhs_begin = lhs_pos;
+            lhs_begin = lhs;
           }
-          lhs_end = lhs_pos + k_;
+          lhs_end = lhs + k_;
 
-          std::uint32_t rhs_pos = matches[j + indices[m]].second << 32 >> 32;
-          rhs_pos = strand ? rhs_pos : (1U << 31) - (rhs_pos + k_ - 1);
-          if (rhs_pos > rhs_end) {
+          std::uint32_t rhs = rhs_pos(m);
+          rhs = strand ? rhs : (1U << 31) - (rhs + k_ - 1);
+          if (rhs > rhs_end) {
             rhs_matches += rhs_end - rhs_begin;
-            rhs_begin = rhs_pos;
+            rhs_begin = rhs;
           }
-          rhs_end = rhs_pos + k_;
+          rhs_end = rhs + k_;
         }
         lhs_matches += lhs_end - lhs_begin;
         rhs_matches += rhs_end - rhs_begin;
@@ -348,15 +1517,11 @@ std::vector<biosoup::Overlap> MinimizerEngine::Chain(
         // clang-format off
         dst.emplace_back(
             lhs_id,
-            matches[j + indices[l]].second >> 32,  // lhs_begin
-            k_ + (matches[j + indices[k - 1]].second >> 32),  // lhs_end
-            matches[j].first >> 33,  // rhs_id
-            strand ?  // rhs_begin
-                matches[j + indices[l]].second << 32 >> 32 :
-                matches[j + indices[k - 1]].second << 32 >> 32,
-            k_ + (strand ?  // rhs_end
-                matches[j + indices[k - 1]].second << 32 >> 32 :
-                matches[j + indices[l]].second << 32 >> 32),
+            lhs_pos(l),  // lhs_begin
+            k_ + lhs_pos(k - 1),  // lhs_end
+            rhs_id,
+            strand ? rhs_pos(l) : rhs_pos(k - 1),  // rhs_begin
+            k_ + (strand ? rhs_pos(k - 1) : rhs_pos(l)),  // rhs_end
             std::min(lhs_matches, rhs_matches),  // score
             strand);
         // clang-format on
@@ -366,6 +1531,23 @@ std::vector<biosoup::Overlap> MinimizerEngine::Chain(
     }
   }
 
+  if (max_per_target_) {  // overlaps are grouped by rhs_id already
+    std::stable_sort(
+        dst.begin(), dst.end(),
+        [](const biosoup::Overlap& lhs, const biosoup::Overlap& rhs) -> bool {
+          return lhs.rhs_id < rhs.rhs_id ||
+                 (lhs.rhs_id == rhs.rhs_id && lhs.score > rhs.score);
+        });
+    std::uint64_t num_overlaps = 0;
+    for (std::uint64_t i = 0, j = 0; i < dst.size(); ++i) {
+      j = i && dst[i].rhs_id == dst[i - 1].rhs_id ? j + 1 : 0;
+      if (j < max_per_target_) {
+        dst[num_overlaps++] = dst[i];
+      }
+    }
+    dst.erase(dst.begin() + num_overlaps, dst.end());
+  }
+
   if (best_n_ && best_n_ < dst.size()) {
     // take only best_n_ overlaps
     std::sort(
@@ -378,24 +1560,21 @@ std::vector<biosoup::Overlap> MinimizerEngine::Chain(
   return dst;
 }
 
-std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Minimize(
-    const std::unique_ptr<biosoup::Sequence>& sequence, bool micromize,
-    double micromize_factor, std::uint8_t N) const {
-  if (sequence->data.size() < k_) {
-    return std::vector<uint128_t>{};
-  }
+template <std::uint32_t K, bool kHpc, bool kRobust, bool kMask>
+std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Sketch(
+    const std::unique_ptr<biosoup::Sequence>& sequence) const {
+  const std::uint32_t k = K ? K : k_;  // K == 0 when k_ is not specialized
+  const std::string& data = sequence->data;
 
-  std::uint64_t mask = (1ULL << (k_ * 2)) - 1;
+  std::vector<uint128_t> dst;
+  if (data.size() < k) {
+    return dst;
+  }
 
-  auto hash = [&](std::uint64_t key) -> std::uint64_t {
-    key = ((~key) + (key << 21)) & mask;
-    key = key ^ (key >> 24);
-    key = ((key + (key << 3)) + (key << 8)) & mask;
-    key = key ^ (key >> 14);
-    key = ((key + (key << 2)) + (key << 4)) & mask;
-    key = key ^ (key >> 28);
-    key = (key + (key << 31)) & mask;
-    return key;
+  const std::uint64_t mask = (k == 32 ? 0 : 1ULL << (k * 2)) - 1;
+  const bool is_weighted = !downweight_.empty();
+  auto weighted = [&](std::uint64_t kmer) -> std::uint64_t {
+    return is_weighted && IsDownweighted(kmer) ? kmer | (mask + 1) : kmer;
   };
 
   std::deque<uint128_t> window;
@@ -417,29 +1596,37 @@ std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Minimize(
       window.pop_front();
       popped = true;
     }
-    if (robust_winnowing_ && popped) {
+    if (kRobust && popped) {
       robust_pop();
     }
   };
 
-  std::uint64_t shift = (k_ - 1) * 2;
+  const std::uint64_t shift = (k - 1) * 2;
   std::uint64_t minimizer = 0;
   std::uint64_t reverse_minimizer = 0;
   std::uint64_t id = static_cast<std::uint64_t>(sequence->id) << 32;
   std::uint64_t is_stored = 1ULL << 63;
 
-  std::vector<uint128_t> dst;
-
   for (std::uint32_t i = 0, win_span = 0, kmer_span = 0, base_cnt = 0;
-       i < sequence->data.size(); ++i, ++win_span, ++kmer_span) {
-    std::uint64_t c = kCoder[sequence->data[i]];
+       i < data.size(); ++i, ++win_span, ++kmer_span) {
+    // restart kmer and window at ambiguous or soft-masked bases
+    if (kMask && IsMasked(data[i], mask_ambiguous_, mask_lowercase_)) {
+      window.clear();
+      minimizer = 0;
+      reverse_minimizer = 0;
+      base_cnt = 0;
+      win_span = kmer_span = -1;  // spans are advanced with i
+      continue;
+    }
+
+    std::uint64_t c = kCoder[data[i]];
     if (c == 255ULL) {
       throw std::invalid_argument(
           "[ram::MinimizerEngine::Minimize] error: invalid character");
     }
 
     // skip homopoly
-    if (hpc_ && i && kCoder[sequence->data[i - 1]] == c) {
+    if (kHpc && base_cnt && kCoder[data[i - 1]] == c) {
       continue;
     }
 
@@ -447,26 +1634,28 @@ std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Minimize(
     base_cnt++;
 
     // remove last from kmer
-    if (base_cnt > k_) {
+    if (base_cnt > k) {
       kmer_span--;
-      if (hpc_) {
-        auto last_c = kCoder[sequence->data[i - kmer_span - 1]];
-        while (kCoder[sequence->data[i - kmer_span]] == last_c) kmer_span--;
+      if (kHpc) {
+        auto last_c = kCoder[data[i - kmer_span - 1]];
+        while (kCoder[data[i - kmer_span]] == last_c) kmer_span--;
       }
     }
 
     minimizer = ((minimizer << 2) | c) & mask;
     reverse_minimizer = (reverse_minimizer >> 2) | ((c ^ 3) << shift);
-    if (base_cnt >= k_) {
+    if (base_cnt >= k) {
       if (minimizer < reverse_minimizer) {
-        window_add(hash(minimizer), (i - (kmer_span)) << 1 | 0);
+        window_add(weighted(Hash(minimizer, mask)),
+                   (i - (kmer_span)) << 1 | 0);
       } else if (minimizer > reverse_minimizer) {
-        window_add(hash(reverse_minimizer), (i - (kmer_span)) << 1 | 1);
+        window_add(weighted(Hash(reverse_minimizer, mask)),
+                   (i - (kmer_span)) << 1 | 1);
       }
     }
-    if (base_cnt >= (k_) + (w_ - 1U)) {
+    if (base_cnt >= k + (w_ - 1U)) {
       auto stop = window.end();
-      if (!window.empty() && robust_winnowing_) stop = window.begin() + 1;
+      if (kRobust && !window.empty()) stop = window.begin() + 1;
       for (auto it = window.begin(); it != stop; ++it) {
         if (it->first != window.front().first) {
           break;
@@ -474,48 +1663,191 @@ std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Minimize(
         if (it->second & is_stored) {
           continue;
         }
-        dst.emplace_back(it->first, id | it->second);
+        dst.emplace_back(it->first & mask, id | it->second);
         it->second |= is_stored;
       }
       win_span--;
-      if (hpc_) {
-        auto last_c = kCoder[sequence->data[i - win_span - 1]];
-        while (kCoder[sequence->data[i - win_span]] == last_c) win_span--;
+      if (kHpc) {
+        auto last_c = kCoder[data[i - win_span - 1]];
+        while (kCoder[data[i - win_span]] == last_c) win_span--;
       }
       window_update(i - win_span);
     }
   }
 
+  return dst;
+}
+
+template <MinimizerEngine::Sampling kSampling, bool kHpc, bool kMask>
+std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Sample(
+    const std::unique_ptr<biosoup::Sequence>& sequence) const {
+  const std::string& data = sequence->data;
+
+  std::vector<uint128_t> dst;
+  if (data.size() < k_) {
+    return dst;
+  }
+
+  const std::uint64_t kmer_mask = (k_ == 32 ? 0 : 1ULL << (k_ * 2)) - 1;
+  const std::uint64_t kmer_shift = (k_ - 1) * 2;
+  const std::uint64_t smer_mask = (s_ == 32 ? 0 : 1ULL << (s_ * 2)) - 1;
+  const std::uint64_t smer_shift = (s_ - 1) * 2;
+  const std::uint32_t open_offset = (k_ - s_) / 2;
+  const std::uint32_t window_len = k_ + w_ - 1;  // mod-minimizer, in bases
+  const std::uint64_t is_invalid = 1ULL << 63;
+
+  // s-mers (t-mers) as (hash, index) with ascending hashes
+  std::deque<std::pair<std::uint64_t, std::uint32_t>> window;
+  // last w_ kmers as (hash, location) for mod-minimizers
+  std::vector<uint128_t> kmers(
+      kSampling == Sampling::kModMinimizer ? std::max(w_, 1U) : 0);
+  // index of the sampled kmer in each slot of kmers (chosen indices are
+  // not monotone, but all of a window map to distinct slots)
+  std::vector<std::uint64_t> sampled(kmers.size(), -1);
+
+  std::uint64_t kmer = 0;
+  std::uint64_t reverse_kmer = 0;
+  std::uint64_t smer = 0;
+  std::uint64_t reverse_smer = 0;
+  std::uint64_t id = static_cast<std::uint64_t>(sequence->id) << 32;
+
+  for (std::uint32_t i = 0, kmer_span = 0, base_cnt = 0; i < data.size();
+       ++i, ++kmer_span) {
+    if (kMask && IsMasked(data[i], mask_ambiguous_, mask_lowercase_)) {
+      window.clear();
+      kmer = reverse_kmer = smer = reverse_smer = 0;
+      base_cnt = 0;
+      kmer_span = -1;  // span is advanced with i
+      std::fill(sampled.begin(), sampled.end(), -1);
+      continue;
+    }
+
+    std::uint64_t c = kCoder[data[i]];
+    if (c == 255ULL) {
+      throw std::invalid_argument(
+          "[ram::MinimizerEngine::Minimize] error: invalid character");
+    }
+
+    if (kHpc && base_cnt && kCoder[data[i - 1]] == c) {
+      continue;
+    }
+    ++base_cnt;
+
+    if (base_cnt > k_) {
+      kmer_span--;
+      if (kHpc) {
+        auto last_c = kCoder[data[i - kmer_span - 1]];
+        while (kCoder[data[i - kmer_span]] == last_c) kmer_span--;
+      }
+    }
+
+    kmer = ((kmer << 2) | c) & kmer_mask;
+    reverse_kmer = (reverse_kmer >> 2) | ((c ^ 3) << kmer_shift);
+    smer = ((smer << 2) | c) & smer_mask;
+    reverse_smer = (reverse_smer >> 2) | ((c ^ 3) << smer_shift);
+
+    if (base_cnt >= s_) {
+      std::uint64_t key = Hash(std::min(smer, reverse_smer), smer_mask);
+      while (!window.empty() && window.back().first > key) {
+        window.pop_back();
+      }
+      window.emplace_back(key, base_cnt - s_);
+    }
+    if (base_cnt < k_) {
+      continue;
+    }
+
+    std::uint32_t kmer_index = base_cnt - k_;
+    std::uint64_t key = Hash(std::min(kmer, reverse_kmer), kmer_mask);
+    std::uint64_t location = static_cast<std::uint64_t>(i - kmer_span) << 1 |
+                             (kmer > reverse_kmer);
+    if (kmer == reverse_kmer) {  // no canonical strand
+      location |= is_invalid;
+    }
+
+    if (kSampling == Sampling::kModMinimizer) {
+      kmers[kmer_index % kmers.size()] = uint128_t(key, location);
+      if (base_cnt < window_len) {
+        continue;
+      }
+
+      std::uint32_t window_begin = base_cnt - window_len;
+      while (window.front().second < window_begin) {
+        window.pop_front();
+      }
+      std::uint64_t chosen =
+          window_begin + (window.front().second - window_begin) % kmers.size();
+      if (sampled[chosen % kmers.size()] == chosen) {
+        continue;
+      }
+      sampled[chosen % kmers.size()] = chosen;
+
+      const auto& it = kmers[chosen % kmers.size()];
+      if (!(it.second & is_invalid)) {
+        dst.emplace_back(it.first, id | it.second);
+      }
+    } else {
+      while (window.front().second < kmer_index) {
+        window.pop_front();
+      }
+      std::uint32_t offset = window.front().second - kmer_index;
+      // with odd k - s the middle offset of the reverse strand mirrors the
+      // forward one, both are taken to sample the same kmers on each strand
+      bool is_syncmer =
+          kSampling == Sampling::kClosedSyncmer
+              ? (offset == 0 || offset == k_ - s_)
+              : (offset == open_offset || offset == k_ - s_ - open_offset);
+      if (is_syncmer && !(location & is_invalid)) {
+        dst.emplace_back(key, id | location);
+      }
+    }
+  }
+
+  return dst;
+}
+
+std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Minimize(
+    const std::unique_ptr<biosoup::Sequence>& sequence, bool micromize,
+    double micromize_factor, std::uint8_t N) const {
+  PerfCounters::Scope scope{PerfCounters::kSketch};
+  auto dst = (this->*sketch_)(sequence);
+  if (dst.empty()) {
+    return dst;
+  }
+
   if (micromize) {
     std::uint32_t take = sequence->data.size() / k_;
     if (micromize_factor > 0.) {
       take = (int)dst.size() * micromize_factor;
     }
     if (take < dst.size()) {
-      if (2 * N <= dst.size())
-        RadixSort(dst.begin() + N, dst.end() - N, k_ * 2, ::First);
-      if (N < take)
-        dst.insert(dst.begin() + take - N, dst.end() - N, dst.end());
+      // first N, smallest of the middle by kmer (then position), last N
+      std::uint32_t head = N < take ? take - N : take;
+      if (2 * N <= dst.size() && head > N) {
+        std::nth_element(dst.begin() + N, dst.begin() + head, dst.end() - N);
+        std::sort(dst.begin() + N, dst.begin() + head);
+      }
+      if (N < take) {
+        std::move(dst.end() - N, dst.end(), dst.begin() + head);
+      }
       dst.resize(take);
     }
   }
-  if (reduce_win_sz_)
-    return Reduce(dst);
-  else
-    return dst;
+  if (reduce_win_sz_) {
+    Reduce(&dst);
+  }
+  return dst;
 }
 
-template <typename T>
-void MinimizerEngine::RadixSort(std::vector<uint128_t>::iterator begin,
-                                std::vector<uint128_t>::iterator end,
-                                std::uint8_t max_bits,
+template <typename I, typename T>
+void MinimizerEngine::RadixSort(I begin, I end, std::uint8_t max_bits,
                                 T compare) {  //  unary comparison function
 
-  if (begin >= end) {
+  if (begin >= end || max_bits == 0) {
     return;
   }
 
-  std::vector<MinimizerEngine::uint128_t> dst(end - begin);
+  std::vector<typename std::iterator_traits<I>::value_type> dst(end - begin);
   auto dst_begin = dst.begin();
   auto dst_end = dst.end();
 
@@ -545,8 +1877,8 @@ void MinimizerEngine::RadixSort(std::vector<uint128_t>::iterator begin,
 
 template <typename T>
 std::vector<std::uint64_t> MinimizerEngine::LongestSubsequence(
-    std::vector<uint128_t>::const_iterator begin,
-    std::vector<uint128_t>::const_iterator end,
+    std::vector<std::uint64_t>::const_iterator begin,
+    std::vector<std::uint64_t>::const_iterator end, std::uint64_t strand,
     T compare) {  // binary comparison function
 
   if (begin >= end) {
@@ -561,9 +1893,9 @@ std::vector<std::uint64_t> MinimizerEngine::LongestSubsequence(
     std::uint64_t lo = 1, hi = longest;
     while (lo <= hi) {
       std::uint64_t mid = lo + (hi - lo) / 2;
-      if (((begin + minimal[mid])->second >> 32) < (it->second >> 32) &&
-          compare((begin + minimal[mid])->second << 32 >> 32,
-                  it->second << 32 >> 32)) {
+      if (::LhsPos(*(begin + minimal[mid])) < ::LhsPos(*it) &&
+          compare(::RhsPos(*(begin + minimal[mid]), strand),
+                  ::RhsPos(*it, strand))) {
         lo = mid + 1;
       } else {
         hi = mid - 1;
@@ -584,28 +1916,230 @@ std::vector<std::uint64_t> MinimizerEngine::LongestSubsequence(
 
   return dst;
 }
+double MinimizerEngine::BytesPerBase() const {
+  double density = 2. / (w_ + 1);  // minimizers and mod-minimizers
+  if (sampling_ == Sampling::kOpenSyncmer) {
+    density = 1. / (k_ - s_ + 1);
+  } else if (sampling_ == Sampling::kClosedSyncmer) {
+    density = 2. / (k_ - s_ + 2);
+  }
+  if (hpc_) {  // homopolymer runs shorten the sequence
+    density *= 0.8;
+  }
+  if (reduce_win_sz_) {
+    density *= 2. / (reduce_win_sz_ + 1);
+  }
+  // posting, its copy while binning and a hash table node with bucket,
+  // plus the target base itself
+  return density * (2 * sizeof(uint128_t) + 40) + 1;
+}
+
 uint64_t MinimizerEngine::GetMinimizerIndexSize() const {
+  if (mapping_) {
+    return mapped_offsets_[mapped_bins_];
+  }
   uint64_t ret = 0;
   for (const auto& it : minimizers_) {
     ret += it.size();
   }
   return ret;
 }
-std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Reduce(
-    const std::vector<uint128_t>& dst) const {
+void MinimizerEngine::ClearCache() {
+  for (auto& it : cache_) {
+    std::lock_guard<std::mutex> lock(it->mutex);
+    it->entries.clear();
+    it->order.clear();
+  }
+}
+
+std::uint64_t MinimizerEngine::NumBins() const {
+  return mapping_ ? mapped_bins_ : minimizers_.size();
+}
+
+std::pair<const MinimizerEngine::uint128_t*, const MinimizerEngine::uint128_t*>
+MinimizerEngine::Postings(std::uint64_t bin) const {
+  if (mapping_) {
+    return std::make_pair(mapped_postings_ + mapped_offsets_[bin],
+                          mapped_postings_ + mapped_offsets_[bin + 1]);
+  }
+  return std::make_pair(minimizers_[bin].data(),
+                        minimizers_[bin].data() + minimizers_[bin].size());
+}
+
+std::pair<const MinimizerEngine::uint128_t*, const MinimizerEngine::uint128_t*>
+MinimizerEngine::Lookup(std::uint64_t kmer) const {
+  std::uint64_t bin = kmer & (NumBins() - 1);
+  if (mapping_) {  // attached bins have no hash table, postings are sorted
+    auto postings = Postings(bin);
+    return std::equal_range(
+        postings.first, postings.second, uint128_t(kmer, 0),
+        [](const uint128_t& lhs, const uint128_t& rhs) -> bool {
+          return lhs.first < rhs.first;
+        });
+  }
+
+  auto match = index_[bin].find(kmer);
+  if (match == index_[bin].end()) {
+    return std::pair<const uint128_t*, const uint128_t*>(nullptr, nullptr);
+  }
+  const uint128_t* begin = minimizers_[bin].data() + match->second.first;
+  return std::make_pair(begin, begin + match->second.second);
+}
+
+std::vector<std::uint64_t> MinimizerEngine::IndexHeader() const {
+  std::vector<std::uint64_t> dst(kIndexHeaderSize, 0);
+  std::memcpy(dst.data(), kIndexMagic, sizeof(std::uint64_t));
+  dst[1] = k_;
+  dst[2] = w_;
+  dst[3] = reduce_win_sz_;
+  dst[4] = robust_winnowing_;
+  dst[5] = hpc_;
+  dst[6] = mask_ambiguous_;
+  dst[7] = mask_lowercase_;
+  dst[8] = static_cast<std::uint64_t>(sampling_);
+  dst[9] = s_;
+  dst[10] = NumBins();
+  dst[11] = GetMinimizerIndexSize();
+  dst[12] = downweight_.size();
+  dst[13] = target_bases_.size();
+  std::memcpy(&dst[14], &downweight_frequency_, sizeof(std::uint64_t));
+  return dst;
+}
+
+void MinimizerEngine::Store(const std::string& path) const {
+  std::ofstream os(path, std::ios::binary | std::ios::trunc);
+  if (!os.is_open()) {
+    throw std::invalid_argument(
+        "[ram::MinimizerEngine::Store] error: unable to open file " + path);
+  }
+
+  auto header = IndexHeader();
+  os.write(reinterpret_cast<const char*>(header.data()),
+           header.size() * sizeof(std::uint64_t));
+
+  std::vector<std::uint64_t> offsets(1, 0);
+  for (std::uint64_t i = 0; i < NumBins(); ++i) {
+    auto postings = Postings(i);
+    offsets.emplace_back(offsets.back() + (postings.second - postings.first));
+  }
+  os.write(reinterpret_cast<const char*>(offsets.data()),
+           offsets.size() * sizeof(std::uint64_t));
+
+  for (std::uint64_t i = 0; i < NumBins(); ++i) {
+    auto postings = Postings(i);
+    os.write(reinterpret_cast<const char*>(postings.first),
+             (postings.second - postings.first) * sizeof(uint128_t));
+  }
+  os.write(reinterpret_cast<const char*>(downweight_.data()),
+           downweight_.size() * sizeof(std::uint64_t));
+
+  std::vector<std::uint64_t> targets;
+  for (std::uint64_t i = 0; i < target_bases_.size(); ++i) {
+    std::uint64_t len =
+        target_bases_[i].second -
+        (i + 1 < target_bases_.size() ? target_bases_[i + 1].second : 0);
+    targets.emplace_back(
+        static_cast<std::uint64_t>(target_bases_[i].first) << 32 | len);
+  }
+  os.write(reinterpret_cast<const char*>(targets.data()),
+           targets.size() * sizeof(std::uint64_t));
+
+  if (!os.good()) {
+    throw std::invalid_argument(
+        "[ram::MinimizerEngine::Store] error: unable to write file " + path);
+  }
+}
+
+void MinimizerEngine::Attach(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::invalid_argument(
+        "[ram::MinimizerEngine::Attach] error: unable to open file " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      static_cast<std::uint64_t>(st.st_size) <
+          kIndexHeaderSize * sizeof(std::uint64_t)) {
+    close(fd);
+    throw std::invalid_argument(
+        "[ram::MinimizerEngine::Attach] error: invalid index file " + path);
+  }
+  std::uint64_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::invalid_argument(
+        "[ram::MinimizerEngine::Attach] error: unable to map file " + path);
+  }
+  std::shared_ptr<const char> mapping(
+      static_cast<const char*>(data), [size](const char* ptr) -> void {
+        munmap(const_cast<char*>(ptr), size);
+      });
+
+  // header has to match this engine, apart from the index dimensions
+  const std::uint64_t* header =
+      reinterpret_cast<const std::uint64_t*>(mapping.get());
+  auto expected = IndexHeader();
+  std::uint64_t num_bins = header[10];
+  std::uint64_t num_postings = header[11];
+  std::uint64_t num_words = header[12];  // of downweight_, a power of 2
+  std::uint64_t num_targets = header[13];
+  if (!std::equal(header, header + 10, expected.begin()) ||
+      header[14] != expected[14] ||  // downweight_frequency_
+      num_bins == 0 || (num_bins & (num_bins - 1)) ||
+      (num_words & (num_words - 1)) ||
+      size != (kIndexHeaderSize + num_bins + 1 + num_words + num_targets) *
+                      sizeof(std::uint64_t) +
+                  num_postings * sizeof(uint128_t)) {
+    throw std::invalid_argument(
+        "[ram::MinimizerEngine::Attach] error: index file " + path +
+        " does not match engine parameters");
+  }
+
+  ClearCache();
+  prefilter_.clear();
+  minimizers_ = std::vector<std::vector<uint128_t>>(1);
+  index_ = std::vector<std::unordered_map<
+      std::uint64_t, std::pair<std::uint32_t, std::uint32_t>>>(1);
+  stats_ = Statistics{};
+  occurrence_ = -1;
+
+  mapping_ = mapping;
+  mapping_size_ = size;
+  mapped_bins_ = num_bins;
+  mapped_offsets_ = header + kIndexHeaderSize;
+  mapped_postings_ =
+      reinterpret_cast<const uint128_t*>(mapped_offsets_ + num_bins + 1);
+
+  auto words = reinterpret_cast<const std::uint64_t*>(mapped_postings_ +
+                                                       num_postings);
+  downweight_.assign(words, words + num_words);
+  downweight_mask_ = num_words ? num_words - 1 : 0;
+
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> targets;
+  for (auto it = words + num_words; it != words + num_words + num_targets;
+       ++it) {
+    targets.emplace_back(*it >> 32, *it & 0xFFFFFFFF);
+  }
+  AddTargets(std::move(targets), false);
+}
+
+void MinimizerEngine::Reduce(std::vector<uint128_t>* dst) const {
   std::uint32_t win_sz = reduce_win_sz_;
 
-  if (dst.empty()) return {};
+  if (dst->empty()) return;
 
-  if (win_sz > dst.size()) {
-    int mini = 0;
-    for (int i = 1; i < (int)dst.size(); i++)
-      if (dst[i].first < dst[mini].first) mini = i;
-    return std::vector<uint128_t>{dst[mini]};
+  if (win_sz > dst->size()) {
+    auto mini = std::min_element(dst->begin(), dst->end(), ::FirstLess);
+    dst->front() = *mini;
+    dst->resize(1);
+    return;
   }
 
-  std::vector<uint128_t> ret;
-  std::vector<bool> stored(dst.size(), false);
+  // collected locations only grow hence the level-2 minimizers are
+  // compacted to the front of dst in place (window keeps its own kmers)
+  std::uint32_t num_stored = 0;
+  std::uint64_t last_stored = -1;
 
   std::deque<std::pair<std::uint64_t, std::uint32_t>> window;
 
@@ -625,24 +2159,27 @@ std::vector<MinimizerEngine::uint128_t> MinimizerEngine::Reduce(
   auto collect = [&]() -> void {
     for (auto it = window.begin(); it != window.end(); it++) {
       if (it->first != window.front().first) break;
-      if (stored[it->second]) continue;
-      stored[it->second] = true;
-      ret.push_back(dst[it->second]);
+      if (last_stored != static_cast<std::uint64_t>(-1) &&
+          it->second <= last_stored) {
+        continue;
+      }
+      last_stored = it->second;
+      (*dst)[num_stored++] = (*dst)[it->second];
     }
   };
 
   for (uint32_t i = 0; i < win_sz; i++) {
-    window_add(dst[i].first, i);
+    window_add((*dst)[i].first, i);
   }
 
-  for (uint32_t i = win_sz; i < dst.size(); i++) {
+  for (uint32_t i = win_sz; i < dst->size(); i++) {
     collect();
     window_update(i - win_sz + 1);
-    window_add(dst[i].first, i);
+    window_add((*dst)[i].first, i);
   }
   collect();
 
-  return ret;
+  dst->resize(num_stored);
 }
 std::vector<biosoup::Overlap> MinimizerEngine::MapBeginEnd(
     const std::unique_ptr<biosoup::Sequence>& sequence, bool avoid_equal,
@@ -651,19 +2188,28 @@ std::vector<biosoup::Overlap> MinimizerEngine::MapBeginEnd(
   if (sequence_size <= 4 * K)
     return Map(sequence, avoid_equal, avoid_symmetric);
 
-  auto begin_seq = std::unique_ptr<biosoup::Sequence>(
-      new biosoup::Sequence(sequence->name, sequence->data.substr(0, K)));
-  auto end_seq = std::unique_ptr<biosoup::Sequence>(new biosoup::Sequence(
-      sequence->name, sequence->data.substr(sequence_size - K, K)));
+  bool is_contained = skip_contained_ && avoid_equal;
+  if (is_contained && IsFlagged(sequence->id)) {
+    return std::vector<biosoup::Overlap>{};
+  }
 
-  auto begin_overlap = Map(begin_seq, avoid_equal, avoid_symmetric);
-  auto end_overlap = Map(end_seq, avoid_equal, avoid_symmetric);
+  // ends keep the id of the sequence so that the avoid flags apply to it
+  auto begin_seq = std::unique_ptr<biosoup::Sequence>(new biosoup::Sequence(
+      sequence->id, sequence->name, sequence->data.substr(0, K)));
+  auto end_seq = std::unique_ptr<biosoup::Sequence>(
+      new biosoup::Sequence(sequence->id, sequence->name,
+                            sequence->data.substr(sequence_size - K, K)));
+
+  auto begin_overlap = MapSketch(begin_seq, avoid_equal, avoid_symmetric);
+  auto end_overlap = MapSketch(end_seq, avoid_equal, avoid_symmetric);
   if (begin_overlap.empty() || end_overlap.empty()) return {};
 
   std::uint64_t min_diff = std::numeric_limits<std::uint64_t>::max();
   int ansi = -1;
   int ansj = -1;
 
+  // pairing the hits of both ends is the lookup of this strategy
+  PerfCounters::Scope scope{PerfCounters::kLookup};
   int max_index_sum = begin_overlap.size() + end_overlap.size() - 2;
   double penalty = 1.0;
   const double penalty_mult = 1.08;
@@ -725,10 +2271,14 @@ std::vector<biosoup::Overlap> MinimizerEngine::MapBeginEnd(
     rhs_end = begin_overlap[ansi].rhs_end;
   }
 
-  return {biosoup::Overlap(lhs_id, lhs_begin, lhs_end, rhs_id, rhs_begin,
-                           rhs_end,
-                           std::max(lhs_end - lhs_begin, rhs_end - rhs_begin),
-                           begin_overlap[ansi].strand)};
+  std::vector<biosoup::Overlap> dst{biosoup::Overlap(
+      lhs_id, lhs_begin, lhs_end, rhs_id, rhs_begin, rhs_end,
+      std::max(lhs_end - lhs_begin, rhs_end - rhs_begin),
+      begin_overlap[ansi].strand)};
+  if (is_contained) {
+    FlagContained(sequence, &dst);
+  }
+  return dst;
 }
 
 }  // namespace ram
@@ -0,0 +1,118 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "numa.hpp"
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// cpu list of sysfs, e.g. 0-3,8-11
+std::vector<std::uint32_t> ParseList(const std::string& list) {
+  std::vector<std::uint32_t> dst;
+  std::istringstream is(list);
+  for (std::string range; std::getline(is, range, ',');) {
+    std::uint32_t begin = 0, end = 0;
+    char dash = 0;
+    std::istringstream rs(range);
+    if (!(rs >> begin)) {
+      continue;
+    }
+    end = (rs >> dash >> end) && dash == '-' ? end : begin;
+    for (std::uint32_t i = begin; i <= end; ++i) {
+      dst.emplace_back(i);
+    }
+  }
+  return dst;
+}
+
+}  // namespace
+
+namespace ram {
+namespace numa {
+
+std::vector<Node> Nodes() {
+  std::vector<Node> dst;
+#ifdef __linux__
+  std::ifstream is("/sys/devices/system/node/online");
+  std::string list;
+  if (!std::getline(is, list)) {
+    return dst;
+  }
+  for (auto id : ParseList(list)) {
+    std::ifstream cs("/sys/devices/system/node/node" + std::to_string(id) +
+                     "/cpulist");
+    std::string cpus;
+    std::getline(cs, cpus);
+    dst.emplace_back(Node{id, ParseList(cpus)});
+  }
+#endif
+  return dst;
+}
+
+bool Pin(const std::vector<std::uint32_t>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const auto& it : cpus) {
+    if (it < CPU_SETSIZE) {
+      CPU_SET(it, &set);
+    }
+  }
+  return CPU_COUNT(&set) > 0 &&
+         pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+InterleaveScope::InterleaveScope(const std::vector<std::uint32_t>& nodes)
+    : is_set_(false), mode_(MPOL_DEFAULT), mask_() {
+#ifdef __linux__
+  if (nodes.empty()) {
+    return;
+  }
+  const std::uint32_t kBits = sizeof(unsigned long) * 8;  // NOLINT
+  mask_.resize(1024 / kBits, 0);  // kernel limit of nodes
+  if (syscall(SYS_get_mempolicy, &mode_, mask_.data(), mask_.size() * kBits,
+              nullptr, 0) != 0) {
+    return;
+  }
+  std::vector<unsigned long> mask(1);  // NOLINT
+  for (const auto& it : nodes) {
+    if (it / kBits >= mask.size()) {
+      mask.resize(it / kBits + 1, 0);
+    }
+    mask[it / kBits] |= 1UL << (it % kBits);
+  }
+  is_set_ = syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask.data(),
+                    mask.size() * kBits + 1) == 0;
+#else
+  (void)nodes;
+#endif
+}
+
+InterleaveScope::~InterleaveScope() {
+#ifdef __linux__
+  if (is_set_) {
+    const std::uint32_t kBits = sizeof(unsigned long) * 8;  // NOLINT
+    if (syscall(SYS_set_mempolicy, mode_, mask_.data(),
+                mask_.size() * kBits + 1) != 0) {
+      syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+    }
+  }
+#endif
+}
+
+}  // namespace numa
+}  // namespace ram
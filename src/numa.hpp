@@ -0,0 +1,46 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAM_NUMA_HPP_
+#define RAM_NUMA_HPP_
+
+#include <cstdint>
+#include <vector>
+
+namespace ram {
+namespace numa {
+
+struct Node {
+  std::uint32_t id;
+  std::vector<std::uint32_t> cpus;
+};
+
+// online nodes with their cpus from sysfs, empty if unknown (e.g. not Linux)
+std::vector<Node> Nodes();
+
+// restrict the calling thread to cpus, false if the kernel refuses
+bool Pin(const std::vector<std::uint32_t>& cpus);
+
+// pages first touched by the calling thread during its lifetime are placed
+// round-robin on nodes (memory policy of the thread, the previous one, e.g.
+// set by numactl, is restored on destruction); does nothing if nodes is empty
+// or the previous policy can not be read
+class InterleaveScope {
+ public:
+  explicit InterleaveScope(const std::vector<std::uint32_t>& nodes);
+  ~InterleaveScope();
+
+  InterleaveScope(const InterleaveScope&) = delete;
+  InterleaveScope& operator=(const InterleaveScope&) = delete;
+
+  bool is_set() const { return is_set_; }
+
+ private:
+  bool is_set_;
+  int mode_;                         // previous policy
+  std::vector<unsigned long> mask_;  // NOLINT
+};
+
+}  // namespace numa
+}  // namespace ram
+
+#endif  // RAM_NUMA_HPP_
@@ -0,0 +1,195 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "ram/overlap_file.hpp"
+
+#include <zlib.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char kMagic[8] = {'r', 'a', 'm', 'o', 'v', 'l', '0', '1'};
+const std::uint32_t kNames = 0;
+const std::uint32_t kOverlaps = 1;
+const std::uint64_t kBlockSize = 1U << 20;
+
+template <typename T>
+void Append(const T& value, std::vector<char>* dst) {
+  const char* src = reinterpret_cast<const char*>(&value);
+  dst->insert(dst->end(), src, src + sizeof(T));
+}
+
+}  // namespace
+
+namespace ram {
+
+OverlapWriter::OverlapWriter(const std::string& path, bool compress)
+    : os_(path, std::ios::binary | std::ios::trunc),
+      compress_(compress),
+      num_names_(0),
+      names_(),
+      records_() {
+  if (!os_.is_open()) {
+    throw std::invalid_argument(
+        "[ram::OverlapWriter::OverlapWriter] error: unable to open file " +
+        path);
+  }
+  os_.write(kMagic, sizeof(kMagic));
+}
+
+OverlapWriter::~OverlapWriter() { Flush(); }
+
+std::uint32_t OverlapWriter::AddName(const std::string& name,
+                                     std::uint32_t length) {
+  Append(static_cast<std::uint32_t>(name.size()), &names_);
+  names_.insert(names_.end(), name.begin(), name.end());
+  Append(length, &names_);
+  return num_names_++;
+}
+
+void OverlapWriter::Write(const OverlapRecord& record) {
+  if (!names_.empty()) {  // names precede the records that use them
+    WriteBlock(kNames, &names_);
+  }
+  Append(record, &records_);
+  if (records_.size() >= kBlockSize) {
+    WriteBlock(kOverlaps, &records_);
+  }
+}
+
+void OverlapWriter::Flush() {
+  WriteBlock(kNames, &names_);
+  WriteBlock(kOverlaps, &records_);
+  os_.flush();
+}
+
+void OverlapWriter::WriteBlock(std::uint32_t type, std::vector<char>* raw) {
+  if (raw->empty()) {
+    return;
+  }
+
+  std::uint32_t raw_size = raw->size();
+  const char* payload = raw->data();
+  uLongf stored_size = raw_size;
+
+  std::vector<char> compressed;
+  if (compress_) {
+    compressed.resize(compressBound(raw_size));
+    stored_size = compressed.size();
+    if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &stored_size,
+                  reinterpret_cast<const Bytef*>(raw->data()), raw_size,
+                  Z_BEST_SPEED) == Z_OK &&
+        stored_size < raw_size) {
+      payload = compressed.data();
+    } else {
+      stored_size = raw_size;
+    }
+  }
+
+  std::uint32_t header[3] = {type, raw_size,
+                             static_cast<std::uint32_t>(stored_size)};
+  os_.write(reinterpret_cast<const char*>(header), sizeof(header));
+  os_.write(payload, stored_size);
+  raw->clear();
+}
+
+OverlapReader::OverlapReader(const std::string& path)
+    : is_(path, std::ios::binary),
+      names_(),
+      lengths_(),
+      records_(),
+      position_(0) {
+  char magic[sizeof(kMagic)] = {};
+  if (!is_.is_open() || !is_.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::invalid_argument(
+        "[ram::OverlapReader::OverlapReader] error: invalid file " + path);
+  }
+}
+
+bool OverlapReader::Read(OverlapRecord* record) {
+  while (position_ == records_.size()) {
+    if (!ReadBlock()) {
+      return false;
+    }
+  }
+  std::memcpy(record, records_.data() + position_, sizeof(OverlapRecord));
+  position_ += sizeof(OverlapRecord);
+  return true;
+}
+
+bool OverlapReader::ReadBlock() {
+  std::uint32_t header[3];
+  if (!is_.read(reinterpret_cast<char*>(header), sizeof(header))) {
+    return false;
+  }
+
+  std::vector<char> stored(header[2]);
+  std::vector<char> raw(header[1]);
+  if (!is_.read(stored.data(), stored.size())) {
+    throw std::invalid_argument(
+        "[ram::OverlapReader::ReadBlock] error: truncated file");
+  }
+  if (header[2] < header[1]) {
+    uLongf raw_size = raw.size();
+    if (uncompress(reinterpret_cast<Bytef*>(raw.data()), &raw_size,
+                   reinterpret_cast<const Bytef*>(stored.data()),
+                   stored.size()) != Z_OK ||
+        raw_size != raw.size()) {
+      throw std::invalid_argument(
+          "[ram::OverlapReader::ReadBlock] error: corrupted block");
+    }
+  } else {
+    raw.swap(stored);
+  }
+
+  if (header[0] == kOverlaps) {
+    records_.swap(raw);
+    records_.resize(records_.size() / sizeof(OverlapRecord) *
+                    sizeof(OverlapRecord));
+    position_ = 0;
+    return true;
+  }
+
+  for (std::uint64_t i = 0; i < raw.size();) {
+    std::uint32_t size, length;
+    if (raw.size() - i < sizeof(size)) {
+      throw std::invalid_argument(
+          "[ram::OverlapReader::ReadBlock] error: corrupted block");
+    }
+    std::memcpy(&size, raw.data() + i, sizeof(size));
+    i += sizeof(size);
+    if (raw.size() - i < sizeof(length) ||
+        raw.size() - i - sizeof(length) < size) {
+      throw std::invalid_argument(
+          "[ram::OverlapReader::ReadBlock] error: corrupted block");
+    }
+    names_.emplace_back(raw.data() + i, size);
+    i += size;
+    std::memcpy(&length, raw.data() + i, sizeof(length));
+    i += sizeof(length);
+    lengths_.emplace_back(length);
+  }
+  return true;
+}
+
+const std::string& OverlapReader::name(std::uint32_t i) const {
+  if (i >= names_.size()) {
+    throw std::invalid_argument(
+        "[ram::OverlapReader::name] error: invalid name index " +
+        std::to_string(i));
+  }
+  return names_[i];
+}
+
+std::uint32_t OverlapReader::length(std::uint32_t i) const {
+  if (i >= lengths_.size()) {
+    throw std::invalid_argument(
+        "[ram::OverlapReader::length] error: invalid name index " +
+        std::to_string(i));
+  }
+  return lengths_[i];
+}
+
+}  // namespace ram
@@ -0,0 +1,57 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAM_PARSER_HPP_
+#define RAM_PARSER_HPP_
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "bioparser/fasta_parser.hpp"
+#include "bioparser/fastq_parser.hpp"
+#include "biosoup/sequence.hpp"
+
+namespace ram {
+
+// parser of a FASTA/FASTQ file chosen by its extension (gzipped or not),
+// nullptr with a message on std::cerr if it can not be created
+inline std::unique_ptr<bioparser::Parser<biosoup::Sequence>> CreateParser(
+    const std::string& path) {
+  auto is_suffix = [](const std::string& s, const std::string& suff) {
+    return s.size() < suff.size()
+               ? false
+               : s.compare(s.size() - suff.size(), suff.size(), suff) == 0;
+  };
+
+  if (is_suffix(path, ".fasta") || is_suffix(path, ".fa") ||
+      is_suffix(path, ".fasta.gz") || is_suffix(path, ".fa.gz")) {
+    try {
+      return bioparser::Parser<biosoup::Sequence>::Create<
+          bioparser::FastaParser>(path);  // NOLINT
+    } catch (const std::invalid_argument& exception) {
+      std::cerr << exception.what() << std::endl;
+      return nullptr;
+    }
+  }
+  if (is_suffix(path, ".fastq") || is_suffix(path, ".fq") ||
+      is_suffix(path, ".fastq.gz") || is_suffix(path, ".fq.gz")) {
+    try {
+      return bioparser::Parser<biosoup::Sequence>::Create<
+          bioparser::FastqParser>(path);  // NOLINT
+    } catch (const std::invalid_argument& exception) {
+      std::cerr << exception.what() << std::endl;
+      return nullptr;
+    }
+  }
+
+  std::cerr << "[ram::CreateParser] error: file " << path
+            << " has unsupported format extension (valid extensions: .fasta, "
+            << ".fasta.gz, .fa, .fa.gz, .fastq, .fastq.gz, .fq, .fq.gz)"
+            << std::endl;
+  return nullptr;
+}
+
+}  // namespace ram
+
+#endif  // RAM_PARSER_HPP_
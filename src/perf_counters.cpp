@@ -0,0 +1,201 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "ram/perf_counters.hpp"
+
+#ifdef RAM_PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+std::atomic<std::uint64_t> totals[ram::PerfCounters::kNumStages]
+                                 [ram::PerfCounters::kNumEvents];
+std::atomic<std::uint64_t> time_enabled{0}, time_running{0};  // of all scopes
+
+#ifdef RAM_PERF_COUNTERS
+
+// counters of the calling thread in one group, read all at once
+class Group {
+ public:
+  Group() : leader_(-1), num_members_(0) {
+    const std::uint64_t kMiss = PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    const std::pair<std::uint32_t, std::uint64_t> kEvents[] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | kMiss},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | kMiss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+    for (std::uint32_t i = 0; i < ram::PerfCounters::kNumEvents; ++i) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = kEvents[i].first;
+      attr.config = kEvents[i].second;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fd == -1) {  // unsupported events are left out of the group
+        continue;
+      }
+      if (leader_ == -1) {
+        leader_ = fd;
+      }
+      fds_[num_members_] = fd;
+      members_[num_members_++] = i;
+    }
+  }
+
+  Group(const Group&) = delete;
+  Group& operator=(const Group&) = delete;
+
+  ~Group() {
+    for (std::uint32_t i = 0; i < num_members_; ++i) {
+      close(fds_[i]);
+    }
+  }
+
+  bool IsAvailable(std::uint32_t event) const {
+    for (std::uint32_t i = 0; i < num_members_; ++i) {
+      if (members_[i] == event) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // counts of each event followed by the time the group was enabled and
+  // the time it was running (less if the kernel multiplexed the counters)
+  void Read(std::uint64_t* dst) const {
+    std::memset(dst, 0,
+                sizeof(std::uint64_t) * (ram::PerfCounters::kNumEvents + 2));
+
+    // nr, time enabled, time running, value...
+    std::uint64_t values[ram::PerfCounters::kNumEvents + 3];
+    if (leader_ == -1 || read(leader_, values, sizeof(values)) <= 0) {
+      return;
+    }
+    for (std::uint32_t i = 0; i < values[0] && i < num_members_; ++i) {
+      dst[members_[i]] = values[i + 3];
+    }
+    dst[ram::PerfCounters::kNumEvents] = values[1];
+    dst[ram::PerfCounters::kNumEvents + 1] = values[2];
+  }
+
+ private:
+  int leader_;
+  std::uint32_t num_members_;
+  int fds_[ram::PerfCounters::kNumEvents];
+  std::uint32_t members_[ram::PerfCounters::kNumEvents];  // event of each fd
+};
+
+Group& ThreadGroup() {
+  thread_local Group group;
+  return group;
+}
+
+#endif
+
+}  // namespace
+
+namespace ram {
+
+#ifdef RAM_PERF_COUNTERS
+
+PerfCounters::Scope::Scope(Stage stage) : stage_(stage) {
+  ThreadGroup().Read(begin_);
+}
+
+PerfCounters::Scope::~Scope() {
+  std::uint64_t end[kNumEvents + 2];
+  ThreadGroup().Read(end);
+  std::uint64_t enabled = end[kNumEvents] - begin_[kNumEvents];
+  std::uint64_t running = end[kNumEvents + 1] - begin_[kNumEvents + 1];
+  time_enabled += enabled;
+  time_running += running;
+  if (running == 0) {  // never scheduled, nothing to extrapolate from
+    return;
+  }
+  for (std::uint32_t i = 0; i < kNumEvents; ++i) {
+    std::uint64_t count = end[i] - begin_[i];
+    if (running < enabled) {
+      count = static_cast<std::uint64_t>(
+          count * (enabled / static_cast<double>(running)));
+    }
+    totals[stage_][i] += count;
+  }
+}
+
+bool PerfCounters::IsAvailable(Event event) {
+  return ThreadGroup().IsAvailable(event);
+}
+
+#else
+
+bool PerfCounters::IsAvailable(Event) { return false; }
+
+#endif
+
+std::uint64_t PerfCounters::Get(Stage stage, Event event) {
+  return totals[stage][event];
+}
+
+double PerfCounters::Running() {
+  std::uint64_t enabled = time_enabled;
+  return enabled ? time_running / static_cast<double>(enabled) : 1.;
+}
+
+void PerfCounters::Reset() {
+  for (auto& it : totals) {
+    for (auto& jt : it) {
+      jt = 0;
+    }
+  }
+  time_enabled = 0;
+  time_running = 0;
+}
+
+void PerfCounters::Report(std::ostream& os) {
+#ifdef RAM_PERF_COUNTERS
+  bool is_available = false;
+  for (std::uint32_t i = 0; i < kNumEvents; ++i) {
+    is_available |= IsAvailable(static_cast<Event>(i));
+  }
+  if (!is_available) {
+    os << "[ram::PerfCounters] counters unavailable "
+       << "(check /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+    return;
+  }
+
+  const char* kStages[] = {"sketch", "lookup", "chain", "output"};
+  for (std::uint32_t i = 0; i < kNumStages; ++i) {
+    std::uint64_t cycles = totals[i][kCycles];
+    std::uint64_t instructions = totals[i][kInstructions];
+    os << "[ram::PerfCounters] " << kStages[i] << ": cycles = " << cycles
+       << ", instructions = " << instructions << ", IPC = "
+       << (cycles ? instructions / static_cast<double>(cycles) : 0.)
+       << ", LLC misses = " << totals[i][kLlcMisses]
+       << ", dTLB misses = " << totals[i][kDtlbMisses]
+       << ", branch misses = " << totals[i][kBranchMisses] << std::endl;
+  }
+  if (Running() < 1.) {
+    os << "[ram::PerfCounters] counters multiplexed, running "
+       << 100. * Running() << "% of the time, counts are scaled estimates"
+       << std::endl;
+  }
+#else
+  (void)os;
+#endif
+}
+
+}  // namespace ram
@@ -0,0 +1,69 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "truth.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace ram {
+
+std::unordered_map<std::string, Truth> LoadTruth(const std::string& path) {
+  std::ifstream is(path);
+  if (!is.is_open()) {
+    throw std::invalid_argument(
+        "[ram::LoadTruth] error: unable to open file " + path);
+  }
+  std::unordered_map<std::string, Truth> dst;
+  for (std::string line; std::getline(is, line);) {
+    std::istringstream ls(line);
+    std::string name, strand;
+    std::uint32_t length, begin, end;
+    Truth truth;
+    if (ls >> name >> length >> begin >> end >> strand >> truth.target >>
+        length >> truth.begin >> truth.end) {
+      truth.strand = strand == "+";
+      dst.emplace(name, truth);
+    }
+  }
+  return dst;
+}
+
+Accuracy Evaluate(
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& targets,
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+    const std::vector<std::vector<biosoup::Overlap>>& overlaps,
+    const std::unordered_map<std::string, Truth>& truths) {
+  Accuracy dst;
+  for (const auto& it : sequences) {
+    auto truth = truths.find(it->name);
+    dst.num_truths += truth != truths.end();
+
+    const auto& o = overlaps[it->id];
+    if (o.empty()) {
+      continue;
+    }
+    ++dst.num_mapped;
+    if (truth == truths.end()) {
+      continue;
+    }
+    ++dst.num_mapped_truths;
+
+    auto best = o.begin();
+    for (auto jt = o.begin(); jt != o.end(); ++jt) {
+      if (jt->score > best->score) {
+        best = jt;
+      }
+    }
+    const auto& target = targets[best->rhs_id - targets.front()->id];
+    if (target->name == truth->second.target &&
+        best->strand == truth->second.strand &&
+        best->rhs_begin < truth->second.end &&
+        truth->second.begin < best->rhs_end) {
+      ++dst.num_correct;
+    }
+  }
+  return dst;
+}
+
+}  // namespace ram
@@ -0,0 +1,57 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAM_TRUTH_HPP_
+#define RAM_TRUTH_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "biosoup/overlap.hpp"
+#include "biosoup/sequence.hpp"
+
+namespace ram {
+
+struct Truth {
+  std::string target;
+  std::uint32_t begin;
+  std::uint32_t end;
+  bool strand;
+};
+
+// first record of each sequence in a PAF file (e.g. simulator output or
+// alignments of a trusted mapper), by sequence name
+std::unordered_map<std::string, Truth> LoadTruth(const std::string& path);
+
+// a sequence is mapped correctly if its best overlap intersects its true
+// interval on the same target and strand
+struct Accuracy {
+  std::uint64_t num_truths = 0;         // sequences with truth
+  std::uint64_t num_mapped = 0;         // sequences with overlaps
+  std::uint64_t num_mapped_truths = 0;  // mapped sequences with truth
+  std::uint64_t num_correct = 0;
+
+  // over sequences with truth
+  double recall() const {
+    return num_truths ? num_correct / static_cast<double>(num_truths) : 0.;
+  }
+  // over mapped sequences with truth
+  double precision() const {
+    return num_mapped_truths
+               ? num_correct / static_cast<double>(num_mapped_truths)
+               : 0.;
+  }
+};
+
+// overlaps are indexed by sequence id, targets have consecutive ids
+Accuracy Evaluate(
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& targets,
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+    const std::vector<std::vector<biosoup::Overlap>>& overlaps,
+    const std::unordered_map<std::string, Truth>& truths);
+
+}  // namespace ram
+
+#endif  // RAM_TRUTH_HPP_
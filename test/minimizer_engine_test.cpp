@@ -2,6 +2,8 @@
 
 #include "ram/minimizer_engine.hpp"
 
+#include <random>
+
 #include "bioparser/fasta_parser.hpp"
 #include "gtest/gtest.h"
 
@@ -78,6 +80,125 @@ TEST_F(RamMinimizerEngineTest, Map) {
   EXPECT_FALSE(o.front().strand);
 }
 
+TEST_F(RamMinimizerEngineTest, Append) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin() + 1, s.end());
+  auto num_minimizers = me.GetMinimizerIndexSize();
+  me.Minimize(s.begin(), s.begin() + 1, true);
+  EXPECT_LT(num_minimizers, me.GetMinimizerIndexSize());
+  me.Filter(0.001);
+
+  auto o = me.Map(s.front(), true, true);
+  EXPECT_EQ(1, o.size());
+  EXPECT_EQ(0, o.front().lhs_id);
+  EXPECT_EQ(30, o.front().lhs_begin);
+  EXPECT_EQ(1869, o.front().lhs_end);
+  EXPECT_EQ(1, o.front().rhs_id);
+  EXPECT_EQ(0, o.front().rhs_begin);
+  EXPECT_EQ(1893, o.front().rhs_end);
+  EXPECT_EQ(585, o.front().score);
+  EXPECT_TRUE(o.front().strand);
+
+  o = me.Map(s.front(), false, true);
+  EXPECT_EQ(2, o.size());
+  EXPECT_TRUE(me.Map(s.back(), true, true).empty());
+
+  me.Minimize(s.begin(), s.begin() + 1);
+  o = me.Map(s.back(), false, false);
+  EXPECT_EQ(1, o.size());
+  EXPECT_EQ(0, o.front().rhs_id);
+}
+
+TEST_F(RamMinimizerEngineTest, AvoidSymmetric) {
+  s.emplace_back(new biosoup::Sequence(2, "d", s.front()->data));
+
+  MinimizerEngine me{15, 5};  // appended in descending ids
+  for (std::uint32_t i = s.size(); i-- > 0;) {
+    me.Minimize(s.begin() + i, s.begin() + i + 1, i + 1 < s.size());
+  }
+  for (const auto& it : s) {
+    auto o = me.Map(it, true, false);
+    o.erase(std::remove_if(o.begin(), o.end(),
+                           [&](const biosoup::Overlap& jt) -> bool {
+                             return jt.rhs_id < it->id;
+                           }),
+            o.end());
+    auto a = me.Map(it, true, true);
+    ASSERT_EQ(o.size(), a.size());
+    for (std::uint32_t i = 0; i < o.size(); ++i) {
+      EXPECT_EQ(o[i].rhs_id, a[i].rhs_id);
+      EXPECT_EQ(o[i].score, a[i].score);
+    }
+  }
+  EXPECT_EQ(2, me.Map(s.front(), true, true).size());
+  EXPECT_TRUE(me.Map(s.back(), true, true).empty());
+}
+
+TEST_F(RamMinimizerEngineTest, MapCost) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+
+  MinimizerEngine::MapOptions options;
+  EXPECT_EQ(s.back()->data.size(), me.MapCost(s.back(), options));
+  EXPECT_LT(me.MapCost(s.front(), options), me.MapCost(s.back(), options));
+
+  options.avoid_symmetric = true;  // s.back() is matched to itself only
+  double total = s.front()->data.size() + s.back()->data.size();
+  EXPECT_EQ(s.front()->data.size(), me.MapCost(s.front(), options));
+  EXPECT_DOUBLE_EQ(s.back()->data.size() * s.back()->data.size() / total,
+                   me.MapCost(s.back(), options));
+
+  me.Minimize(s.begin(), s.begin() + 1, true);  // keeps the suffix sums
+  EXPECT_EQ(s.front()->data.size(), me.MapCost(s.front(), options));
+}
+
+TEST_F(RamMinimizerEngineTest, Placement) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  me.Filter(0.001);
+  auto o = me.Map(s.front(), true, true);
+  ASSERT_EQ(1, o.size());
+
+  for (auto placement : {MinimizerEngine::Placement::kInterleave,
+                         MinimizerEngine::Placement::kFirstTouch}) {
+    MinimizerEngine::Options options;
+    options.placement = placement;
+    MinimizerEngine mp{15, 5, 100, 10000, 4, 0, 0, false, false,
+                       std::make_shared<thread_pool::ThreadPool>(2), options};
+    mp.Minimize(s.begin() + 1, s.end());
+    mp.Minimize(s.begin(), s.begin() + 1, true);
+    mp.Filter(0.001);
+    EXPECT_EQ(me.GetMinimizerIndexSize(), mp.GetMinimizerIndexSize());
+    auto p = mp.Map(s.front(), true, true);
+    ASSERT_EQ(1, p.size());
+    EXPECT_EQ(o.front().rhs_begin, p.front().rhs_begin);
+    EXPECT_EQ(o.front().score, p.front().score);
+  }
+
+  auto thread_pool = std::make_shared<thread_pool::ThreadPool>(2);
+  auto f = thread_pool->Submit([&]() -> void {  // would wait for itself
+    MinimizerEngine::Options options;
+    options.placement = MinimizerEngine::Placement::kFirstTouch;
+    MinimizerEngine mp{15, 5, 100, 10000, 4, 0, 0, false, false,
+                       thread_pool, options};
+  });
+  EXPECT_THROW(f.get(), std::invalid_argument);
+}
+
+TEST_F(RamMinimizerEngineTest, Prefilter) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  auto o = me.Map(s.front(), true, true);
+
+  me.Filter(0);  // keeps all kmers
+  auto f = me.Map(s.front(), true, true);
+  ASSERT_EQ(o.size(), f.size());
+  EXPECT_EQ(o.front().lhs_begin, f.front().lhs_begin);
+  EXPECT_EQ(o.front().rhs_end, f.front().rhs_end);
+  EXPECT_EQ(o.front().score, f.front().score);
+  EXPECT_LT(me.GetMinimizerIndexSize() * 16, me.Stats().num_bytes);
+}
+
 TEST_F(RamMinimizerEngineTest, Pair) {
   MinimizerEngine me{15, 5};
   auto o = me.Map(s.front(), s.back());
@@ -132,6 +253,300 @@ TEST_F(RamMinimizerEngineTest, Filter) {
   EXPECT_TRUE(o.front().strand);
 }
 
+TEST_F(RamMinimizerEngineTest, Stats) {
+  MinimizerEngine me{9, 3};
+  me.Minimize(s.begin(), s.end());
+  EXPECT_EQ(0, me.Stats().num_keys);
+
+  me.Filter(0.001);
+  const auto& stats = me.Stats();
+  EXPECT_EQ(me.GetMinimizerIndexSize(), stats.num_minimizers);
+  EXPECT_LT(0, stats.num_keys);
+  EXPECT_LE(stats.num_singletons, stats.num_keys);
+  EXPECT_LT(stats.num_minimizers * 16, stats.num_bytes);
+
+  std::uint64_t num_keys = 0;
+  for (const auto& it : stats.histogram) {
+    num_keys += it;
+  }
+  EXPECT_EQ(stats.num_keys, num_keys);
+  EXPECT_EQ(stats.num_singletons, stats.histogram.front());
+  EXPECT_LT(1, stats.occurrence);
+
+  me.Filter(0);
+  EXPECT_EQ(static_cast<std::uint32_t>(-1), me.Stats().occurrence);
+  EXPECT_EQ(num_keys, me.Stats().num_keys);
+}
+
+TEST_F(RamMinimizerEngineTest, BytesPerBase) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  std::uint64_t num_bases = 0;
+  for (const auto& it : s) {
+    num_bases += it->data.size();
+  }
+  EXPECT_LT(me.GetMinimizerIndexSize() * 16, num_bases * me.BytesPerBase());
+
+  EXPECT_GT(me.BytesPerBase(), MinimizerEngine(15, 10).BytesPerBase());
+  EXPECT_GT(me.BytesPerBase(),
+            MinimizerEngine(15, 5, 100, 10000, 4, 0, 5).BytesPerBase());
+}
+
+TEST_F(RamMinimizerEngineTest, StoreAttach) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  me.Filter(0.001);
+  auto path = ::testing::TempDir() + "ram_store_attach_test.idx";
+  me.Store(path);
+
+  MinimizerEngine ma{15, 5};
+  ma.Attach(path);
+  ma.Filter(0.001);
+  EXPECT_EQ(me.GetMinimizerIndexSize(), ma.GetMinimizerIndexSize());
+  EXPECT_EQ(me.Stats().num_keys, ma.Stats().num_keys);
+  EXPECT_EQ(me.Stats().occurrence, ma.Stats().occurrence);
+
+  auto o = me.Map(s.front(), true, true);
+  auto a = ma.Map(s.front(), true, true);
+  ASSERT_EQ(o.size(), a.size());
+  for (std::uint32_t i = 0; i < o.size(); ++i) {
+    EXPECT_EQ(o[i].rhs_id, a[i].rhs_id);
+    EXPECT_EQ(o[i].rhs_begin, a[i].rhs_begin);
+    EXPECT_EQ(o[i].rhs_end, a[i].rhs_end);
+    EXPECT_EQ(o[i].score, a[i].score);
+  }
+  EXPECT_EQ(2, ma.TargetLengths().size());
+  EXPECT_EQ(me.TargetLengths(), ma.TargetLengths());
+
+  ma.Minimize(s.end(), s.end(), true);  // appending nothing keeps the index
+  ma.Filter(0.001);
+  EXPECT_EQ(o.size(), ma.Map(s.front(), true, true).size());
+
+  MinimizerEngine mk{13, 5};
+  EXPECT_THROW(mk.Attach(path), std::invalid_argument);
+  std::remove(path.c_str());
+  EXPECT_THROW(mk.Attach(path), std::invalid_argument);
+}
+
+TEST_F(RamMinimizerEngineTest, Cache) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin() + 1, s.end());
+  auto o = me.Map(s.front(), false, false);
+  ASSERT_EQ(1, o.size());
+
+  MinimizerEngine::Options options;
+  options.cache_size = 16;
+  MinimizerEngine mc{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  mc.Minimize(s.begin() + 1, s.end());
+  EXPECT_EQ(1, mc.Map(s.front(), false, false).size());
+
+  std::unique_ptr<biosoup::Sequence> d{
+      new biosoup::Sequence(42, "d", s.front()->data)};
+  auto c = mc.Map(d, false, false);
+  ASSERT_EQ(1, c.size());
+  EXPECT_EQ(42, c.front().lhs_id);
+  EXPECT_EQ(o.front().rhs_id, c.front().rhs_id);
+  EXPECT_EQ(o.front().rhs_begin, c.front().rhs_begin);
+  EXPECT_EQ(o.front().rhs_end, c.front().rhs_end);
+  EXPECT_EQ(o.front().lhs_begin, c.front().lhs_begin);
+  EXPECT_EQ(o.front().lhs_end, c.front().lhs_end);
+  EXPECT_EQ(o.front().score, c.front().score);
+
+  d->ReverseAndComplement();  // mapped, not mirrored
+  o = me.Map(d, false, false);
+  c = mc.Map(d, false, false);
+  ASSERT_EQ(1, o.size());
+  ASSERT_EQ(1, c.size());
+  EXPECT_EQ(o.front().lhs_begin, c.front().lhs_begin);
+  EXPECT_EQ(o.front().lhs_end, c.front().lhs_end);
+  EXPECT_EQ(o.front().score, c.front().score);
+  EXPECT_FALSE(c.front().strand);
+
+  mc.Minimize(s.begin(), s.begin() + 1);  // index changes clear the cache
+  c = mc.Map(d, false, false);
+  ASSERT_EQ(1, c.size());
+  EXPECT_EQ(0, c.front().rhs_id);
+}
+
+TEST_F(RamMinimizerEngineTest, SkipContained) {
+  s.emplace_back(new biosoup::Sequence(2, "c", s.back()->data.substr(200)));
+
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  EXPECT_EQ(2, me.Map(s[1], true, false).size());
+
+  MinimizerEngine::Options options;
+  options.skip_contained = true;
+  MinimizerEngine mc{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  mc.Minimize(s.begin(), s.end());
+  auto o = mc.Map(s[2], true, false);  // c is contained in s[1]
+  EXPECT_TRUE(o.empty());
+  o = mc.Map(s[1], true, false);  // flags s[0], drops it and c
+  EXPECT_TRUE(o.empty());
+  EXPECT_TRUE(mc.Map(s[0], true, false).empty());
+
+  // other strategies, with lengths from an attached index
+  auto path = ::testing::TempDir() + "ram_skip_contained_test.idx";
+  mc.Store(path);
+  MinimizerEngine::MapOptions coarse, begin_end;
+  coarse.avoid_equal = begin_end.avoid_equal = true;
+  coarse.coarse_factor = 1.;
+  begin_end.K = 200;
+  for (const auto& it : {coarse, begin_end}) {
+    EXPECT_FALSE(me.Map(s[2], it).empty());
+
+    MinimizerEngine ma{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                       options};
+    ma.Attach(path);
+    ma.Filter(0.001);
+    EXPECT_TRUE(ma.Map(s[2], it).empty());
+    for (const auto& jt : ma.Map(s[1], it)) {
+      EXPECT_NE(2, jt.rhs_id);
+    }
+  }
+  std::remove(path.c_str());
+}
+
+TEST_F(RamMinimizerEngineTest, MaxPerTarget) {
+  std::unique_ptr<biosoup::Sequence> r{
+      new biosoup::Sequence(2, "r", s.front()->data + s.front()->data)};
+
+  MinimizerEngine me{15, 5};
+  EXPECT_EQ(2, me.Map(s.front(), r).size());
+
+  MinimizerEngine::Options options;
+  options.max_per_target = 1;
+  MinimizerEngine mq{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  auto o = mq.Map(s.front(), r);
+  ASSERT_EQ(1, o.size());
+  EXPECT_EQ(2, o.front().rhs_id);
+}
+
+TEST_F(RamMinimizerEngineTest, Downweight) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+
+  MinimizerEngine::Options options;
+  options.downweight_frequency = 0.1;
+  MinimizerEngine mw{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  mw.Minimize(s.begin(), s.end());
+  EXPECT_NE(me.GetMinimizerIndexSize(), mw.GetMinimizerIndexSize());
+  auto o = mw.Map(s.front(), true, true);
+  ASSERT_EQ(1, o.size());
+  EXPECT_EQ(1, o.front().rhs_id);
+  EXPECT_TRUE(o.front().strand);
+
+  auto path = ::testing::TempDir() + "ram_downweight_test.idx";
+  mw.Store(path);
+  MinimizerEngine ma{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  ma.Attach(path);
+  EXPECT_EQ(mw.GetMinimizerIndexSize(), ma.GetMinimizerIndexSize());
+  auto a = ma.Map(s.front(), true, true);
+  ASSERT_EQ(1, a.size());
+  EXPECT_EQ(o.front().rhs_begin, a.front().rhs_begin);
+  EXPECT_EQ(o.front().score, a.front().score);
+
+  EXPECT_THROW(me.Attach(path), std::invalid_argument);
+
+  // too short to have frequent kmers, nothing is down-weighted
+  std::vector<std::unique_ptr<biosoup::Sequence>> t;
+  t.emplace_back(new biosoup::Sequence("t", s.front()->data.substr(0, 60)));
+  mw.Minimize(t.begin(), t.end());
+  mw.Store(path);
+  ma.Attach(path);
+  EXPECT_EQ(mw.GetMinimizerIndexSize(), ma.GetMinimizerIndexSize());
+  EXPECT_THROW(me.Attach(path), std::invalid_argument);
+  std::remove(path.c_str());
+}
+
+TEST_F(RamMinimizerEngineTest, MaxPostings) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  ASSERT_EQ(1, me.Map(s.front(), true, true).size());
+
+  MinimizerEngine::Options options;
+  options.max_postings = 1;
+  MinimizerEngine mp{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  mp.Minimize(s.begin(), s.end());
+  EXPECT_LT(mp.GetMinimizerIndexSize(), me.GetMinimizerIndexSize());
+  EXPECT_TRUE(mp.Map(s.front(), true, true).empty());  // shared keys dropped
+}
+
+TEST_F(RamMinimizerEngineTest, Align) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  auto o = me.Map(s.front(), true, true);
+  ASSERT_EQ(1, o.size());
+  me.Align(s.front(), s[o.front().rhs_id], &o.front());
+
+  std::uint32_t lhs_len = 0, rhs_len = 0, matches = 0, num = 0;
+  for (const auto& c : o.front().alignment) {
+    if (std::isdigit(c)) {
+      num = num * 10 + (c - '0');
+      continue;
+    }
+    lhs_len += c != 'D' ? num : 0;
+    rhs_len += c != 'I' ? num : 0;
+    matches += c == '=' ? num : 0;
+    num = 0;
+  }
+  EXPECT_EQ(o.front().lhs_end - o.front().lhs_begin, lhs_len);
+  EXPECT_EQ(o.front().rhs_end - o.front().rhs_begin, rhs_len);
+  EXPECT_LT(o.front().score, matches);
+
+  o.front().rhs_end = s[o.front().rhs_id]->data.size() + 1;
+  EXPECT_THROW(me.Align(s.front(), s[o.front().rhs_id], &o.front()),
+               std::invalid_argument);
+}
+
+TEST_F(RamMinimizerEngineTest, AlignInsertion) {
+  std::mt19937 generator(42);
+  std::string data;
+  for (std::uint32_t i = 0; i < 2000; ++i) {
+    data += "ACGT"[generator() & 3];
+  }
+  std::string insertion;  // differs from both flanks, hence placed uniquely
+  for (auto c : std::string("ACGT")) {
+    if (c != data[999] && c != data[1000]) {
+      insertion.assign(5, c);
+    }
+  }
+  std::unique_ptr<biosoup::Sequence> target{new biosoup::Sequence("t", data)};
+  std::unique_ptr<biosoup::Sequence> read{new biosoup::Sequence(
+      "r", data.substr(0, 1000) + insertion + data.substr(1000))};
+
+  MinimizerEngine me{15, 5};
+  biosoup::Overlap o{0, 0, 2005, 1, 0, 2000, 0, true};
+  me.Align(read, target, &o);
+  EXPECT_EQ("1000=5I1000=", o.alignment);  // read-side insertion
+
+  read->ReverseAndComplement();
+  o = biosoup::Overlap{0, 0, 2005, 1, 0, 2000, 0, false};
+  me.Align(read, target, &o);
+  EXPECT_EQ("1000=5I1000=", o.alignment);
+
+  // no matches in between and too many cells to be filled
+  std::string other;
+  for (std::uint32_t i = 0; i < 1100000; ++i) {
+    other += "ACGT"[generator() & 3];
+  }
+  target.reset(new biosoup::Sequence("t", other));
+  read.reset(new biosoup::Sequence("r", other.substr(0, 1000000)));
+  for (std::uint32_t i = 0; i < read->data.size(); i += 10) {
+    read->data[i] = read->data[i] == 'A' ? 'C' : 'A';
+  }
+  MinimizerEngine ml{25, 10};
+  o = biosoup::Overlap{0, 0, 1000000, 1, 0, 1100000, 0, true};
+  ml.Align(read, target, &o);
+  EXPECT_TRUE(o.alignment.empty());
+}
+
 TEST_F(RamMinimizerEngineTest, Micromize) {
   MinimizerEngine me{15, 5};
   me.Minimize(s.begin(), s.end());
@@ -184,5 +599,167 @@ TEST_F(RamMinimizerEngineTest, MicromizeExtend) {
   EXPECT_TRUE(o.front().strand);
 }
 
+TEST_F(RamMinimizerEngineTest, CoarseToFine) {
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  auto o = me.Map(s.front(), true, true);
+  auto c = me.MapCoarseToFine(s.front(), true, true, 0.2);
+  ASSERT_EQ(o.size(), c.size());
+  EXPECT_EQ(o.front().rhs_id, c.front().rhs_id);
+  EXPECT_EQ(o.front().strand, c.front().strand);
+  EXPECT_GE(o.front().score, c.front().score);
+
+  EXPECT_TRUE(me.MapCoarseToFine(s.back(), true, true, 0.2).empty());
+}
+
+TEST_F(RamMinimizerEngineTest, MapBatch) {
+  MinimizerEngine me{15, 5, 100, 10000, 4, 0, 0, false, false,
+                     std::make_shared<thread_pool::ThreadPool>(2)};
+  me.Minimize(s.begin(), s.end());
+
+  MinimizerEngine::MapOptions options;
+  options.avoid_equal = true;
+  std::mutex mutex;
+  std::vector<std::vector<biosoup::Overlap>> o(s.size());
+  me.MapBatch(s.begin(), s.end(), options,
+              [&](const std::unique_ptr<biosoup::Sequence>& sequence,
+                  std::vector<biosoup::Overlap>&& overlaps) -> void {
+                std::lock_guard<std::mutex> lock(mutex);
+                o[sequence->id].swap(overlaps);
+              })
+      .get();
+  for (const auto& it : s) {
+    auto m = me.Map(it, true, false);
+    ASSERT_FALSE(m.empty());
+    ASSERT_EQ(m.size(), o[it->id].size());
+    for (std::uint32_t i = 0; i < m.size(); ++i) {
+      EXPECT_EQ(m[i].rhs_id, o[it->id][i].rhs_id);
+      EXPECT_EQ(m[i].score, o[it->id][i].score);
+    }
+  }
+
+  auto f = me.MapBatch(s.begin(), s.end(), options,
+                       [](const std::unique_ptr<biosoup::Sequence>&,
+                          std::vector<biosoup::Overlap>&&) -> void {
+                         throw std::runtime_error("callback");
+                       });
+  EXPECT_THROW(f.get(), std::runtime_error);
+  me.MapBatch(s.end(), s.end(), options, nullptr).get();
+}
+
+TEST_F(RamMinimizerEngineTest, MaskAmbiguous) {
+  std::vector<std::unique_ptr<biosoup::Sequence>> n;
+  n.emplace_back(new biosoup::Sequence("N", std::string(1000, 'N')));
+
+  MinimizerEngine me{15, 5};
+  me.Minimize(n.begin(), n.end());
+  EXPECT_LT(0, me.GetMinimizerIndexSize());
+
+  MinimizerEngine::Options options;
+  options.mask_ambiguous = true;
+  MinimizerEngine mm{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  mm.Minimize(n.begin(), n.end());
+  EXPECT_EQ(0, mm.GetMinimizerIndexSize());
+
+  n.front()->data[500] = '*';
+  EXPECT_THROW(me.Minimize(n.begin(), n.end()), std::invalid_argument);
+  EXPECT_NO_THROW(mm.Minimize(n.begin(), n.end()));
+
+  s.front()->data.replace(900, 100, std::string(100, 'N'));
+  mm.Minimize(s.begin(), s.end());
+  mm.Filter(0.001);
+  auto o = mm.Map(s.front(), true, true);
+  EXPECT_EQ(1, o.size());
+  EXPECT_EQ(0, o.front().lhs_id);
+  EXPECT_EQ(1, o.front().rhs_id);
+  EXPECT_TRUE(o.front().strand);
+}
+
+TEST_F(RamMinimizerEngineTest, MaskLowercase) {
+  for (auto& it : s.back()->data) {
+    it = std::tolower(it);
+  }
+
+  MinimizerEngine me{15, 5};
+  me.Minimize(s.begin(), s.end());
+  EXPECT_EQ(1, me.Map(s.front(), true, true).size());
+
+  MinimizerEngine::Options options;
+  options.mask_lowercase = true;
+  MinimizerEngine mm{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  mm.Minimize(s.begin(), s.end());
+  EXPECT_TRUE(mm.Map(s.front(), true, true).empty());
+}
+
+TEST_F(RamMinimizerEngineTest, Sampling) {
+  for (auto sampling : {MinimizerEngine::Sampling::kOpenSyncmer,
+                        MinimizerEngine::Sampling::kClosedSyncmer,
+                        MinimizerEngine::Sampling::kModMinimizer}) {
+    MinimizerEngine::Options options;
+    options.sampling = sampling;
+    MinimizerEngine me{15, 5, 100, 10000, 4, 0, 0, false, false, nullptr,
+                       options};
+    me.Minimize(s.begin(), s.end());
+    me.Filter(0.001);
+    EXPECT_LT(0, me.GetMinimizerIndexSize());
+
+    auto o = me.Map(s.front(), true, true);
+    EXPECT_EQ(1, o.size());
+    EXPECT_EQ(0, o.front().lhs_id);
+    EXPECT_EQ(1, o.front().rhs_id);
+    EXPECT_TRUE(o.front().strand);
+
+    s.front()->ReverseAndComplement();
+    o = me.Map(s.front(), s.back());
+    EXPECT_EQ(1, o.size());
+    EXPECT_FALSE(o.front().strand);
+    s.front()->ReverseAndComplement();
+  }
+
+  // with k - t not divisible by w mod-minimizer positions are not monotone,
+  // each has to be sampled once
+  std::mt19937 generator(42);
+  std::string data;
+  for (std::uint32_t i = 0; i < 100000; ++i) {
+    data += "ACGT"[generator() & 3];
+  }
+  std::vector<std::unique_ptr<biosoup::Sequence>> r;
+  r.emplace_back(new biosoup::Sequence(0, "r", data));
+
+  // both strands sample the same kmers, also with odd k - s (k15 w10, s6)
+  std::unique_ptr<biosoup::Sequence> q{
+      new biosoup::Sequence(1, "q", data.substr(50000, 3000))};
+  for (auto sampling : {MinimizerEngine::Sampling::kOpenSyncmer,
+                        MinimizerEngine::Sampling::kClosedSyncmer,
+                        MinimizerEngine::Sampling::kModMinimizer}) {
+    MinimizerEngine::Options options;
+    options.sampling = sampling;
+    MinimizerEngine me{15, 10, 100, 10000, 4, 0, 0, false, false, nullptr,
+                       options};
+    me.Minimize(r.begin(), r.end());
+    auto o = me.Map(q, false, false);
+    ASSERT_EQ(1, o.size());
+    EXPECT_TRUE(o.front().strand);
+
+    q->ReverseAndComplement();
+    auto c = me.Map(q, false, false);
+    q->ReverseAndComplement();
+    ASSERT_EQ(1, c.size());
+    EXPECT_FALSE(c.front().strand);
+    EXPECT_NEAR(o.front().score, c.front().score, o.front().score / 100.);
+  }
+
+  MinimizerEngine::Options options;
+  options.sampling = MinimizerEngine::Sampling::kModMinimizer;
+  options.smer_len = 7;
+  MinimizerEngine me{25, 10, 100, 10000, 4, 0, 0, false, false, nullptr,
+                     options};
+  me.Minimize(r.begin(), r.end());
+  me.Filter(0);
+  EXPECT_EQ(me.Stats().num_keys, me.Stats().num_minimizers);  // no repeats
+}
+
 }  // namespace test
 }  // namespace ram
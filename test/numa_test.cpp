@@ -0,0 +1,94 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "numa.hpp"
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "gtest/gtest.h"
+
+namespace ram {
+namespace test {
+
+#ifdef __linux__
+
+int Policy() {
+  int mode = -1;
+  unsigned long mask[16] = {0};  // NOLINT
+  syscall(SYS_get_mempolicy, &mode, mask, sizeof(mask) * 8, nullptr, 0);
+  return mode;
+}
+
+TEST(RamNumaTest, Nodes) {
+  auto nodes = numa::Nodes();
+  if (nodes.empty()) {
+    GTEST_SKIP() << "no NUMA information in sysfs";
+  }
+  std::uint32_t num_cpus = 0;
+  for (const auto& it : nodes) {
+    num_cpus += it.cpus.size();
+  }
+  EXPECT_LT(0, num_cpus);
+}
+
+TEST(RamNumaTest, Pin) {
+  auto nodes = numa::Nodes();
+  if (nodes.empty() || nodes.front().cpus.empty()) {
+    GTEST_SKIP() << "no NUMA information in sysfs";
+  }
+  cpu_set_t set;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(set), &set));
+
+  EXPECT_TRUE(numa::Pin({nodes.front().cpus.front()}));
+  cpu_set_t pinned;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(pinned), &pinned));
+  EXPECT_EQ(1, CPU_COUNT(&pinned));
+  EXPECT_TRUE(CPU_ISSET(nodes.front().cpus.front(), &pinned));
+
+  EXPECT_FALSE(numa::Pin({}));
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+TEST(RamNumaTest, InterleaveScope) {
+  auto nodes = numa::Nodes();
+  if (nodes.empty()) {
+    GTEST_SKIP() << "no NUMA information in sysfs";
+  }
+  ASSERT_EQ(MPOL_DEFAULT, Policy());
+  {
+    numa::InterleaveScope scope{{}};
+    EXPECT_FALSE(scope.is_set());
+    EXPECT_EQ(MPOL_DEFAULT, Policy());
+  }
+  {
+    numa::InterleaveScope scope{{nodes.front().id}};
+    if (scope.is_set()) {  // unless set_mempolicy is filtered
+      EXPECT_EQ(MPOL_INTERLEAVE, Policy());
+    }
+  }
+  EXPECT_EQ(MPOL_DEFAULT, Policy());
+
+  unsigned long mask[16] = {0};  // NOLINT, e.g. numactl --preferred
+  mask[0] = 1UL << nodes.front().id;
+  if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8) !=
+      0) {
+    return;
+  }
+  {
+    numa::InterleaveScope scope{{nodes.front().id}};
+    if (scope.is_set()) {
+      EXPECT_EQ(MPOL_INTERLEAVE, Policy());
+    }
+  }
+  EXPECT_EQ(MPOL_PREFERRED, Policy());
+  syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+}
+
+#endif
+
+}  // namespace test
+}  // namespace ram
@@ -0,0 +1,105 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "ram/overlap_file.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace ram {
+namespace test {
+
+TEST(RamOverlapFileTest, WriteRead) {
+  auto path = ::testing::TempDir() + "ram_overlap_file_test.ovl";
+  for (bool compress : {false, true}) {
+    {
+      OverlapWriter w{path, compress};
+      EXPECT_EQ(0, w.AddName("target", 1000));
+      EXPECT_EQ(1, w.AddName("read", 100));
+      for (std::uint32_t i = 0; i < 100000; ++i) {
+        w.Write(OverlapRecord{1, 0, 100, 0, i, i + 100, 90, 100, i & 1});
+      }
+      EXPECT_EQ(2, w.AddName("late", 10));
+      w.Write(OverlapRecord{2, 1, 9, 0, 0, 8, 8, 8, 1});
+    }
+
+    OverlapReader r{path};
+    OverlapRecord o;
+    for (std::uint32_t i = 0; i < 100000; ++i) {
+      ASSERT_TRUE(r.Read(&o));
+      EXPECT_EQ(1, o.lhs);
+      EXPECT_EQ(i, o.rhs_begin);
+      EXPECT_EQ(i & 1, o.strand);
+    }
+    ASSERT_TRUE(r.Read(&o));
+    EXPECT_EQ("late", r.name(o.lhs));
+    EXPECT_EQ(10, r.length(o.lhs));
+    EXPECT_EQ("target", r.name(o.rhs));
+    EXPECT_EQ(1000, r.length(o.rhs));
+    EXPECT_FALSE(r.Read(&o));
+  }
+  std::remove(path.c_str());
+
+  EXPECT_THROW(OverlapReader{path}, std::invalid_argument);
+}
+
+TEST(RamOverlapFileTest, Corrupted) {
+  auto path = ::testing::TempDir() + "ram_overlap_file_test.ovl";
+  {
+    OverlapWriter w{path, false};
+    w.AddName("target", 1000);
+    w.Write(OverlapRecord{0, 0, 100, 0, 0, 100, 90, 100, 0});
+  }
+  std::string data;
+  {
+    std::ifstream is(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(is),
+                std::istreambuf_iterator<char>());
+  }
+  auto write = [&](const std::string& s) -> void {
+    std::ofstream os(path, std::ios::binary);
+    os.write(s.data(), s.size());
+  };
+  OverlapRecord o;
+
+  {
+    OverlapReader r{path};
+    ASSERT_TRUE(r.Read(&o));
+    EXPECT_EQ("target", r.name(0));
+    EXPECT_THROW(r.name(1), std::invalid_argument);
+    EXPECT_THROW(r.length(1), std::invalid_argument);
+  }
+
+  write(data.substr(0, data.size() - 4));  // truncated
+  {
+    OverlapReader r{path};
+    EXPECT_THROW(r.Read(&o), std::invalid_argument);
+  }
+
+  auto corrupted = data;  // name longer than the names block
+  std::uint32_t size = 1000;
+  std::memcpy(&corrupted[8 + 12], &size, sizeof(size));
+  write(corrupted);
+  {
+    OverlapReader r{path};
+    EXPECT_THROW(r.Read(&o), std::invalid_argument);
+  }
+
+  corrupted = data;  // length field cut off
+  size = 7;
+  std::memcpy(&corrupted[8 + 12], &size, sizeof(size));
+  write(corrupted);
+  {
+    OverlapReader r{path};
+    EXPECT_THROW(r.Read(&o), std::invalid_argument);
+  }
+  std::remove(path.c_str());
+}
+
+}  // namespace test
+}  // namespace ram
@@ -0,0 +1,47 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "ram/perf_counters.hpp"
+
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+namespace ram {
+namespace test {
+
+TEST(RamPerfCountersTest, Scope) {
+  PerfCounters::Reset();
+  volatile std::uint64_t sum = 0;
+  {
+    PerfCounters::Scope scope{PerfCounters::kChain};
+    for (std::uint64_t i = 0; i < 1000000; ++i) {
+      sum += i;
+    }
+  }
+  EXPECT_EQ(0, PerfCounters::Get(PerfCounters::kSketch,
+                                 PerfCounters::kInstructions));
+  if (PerfCounters::IsAvailable(PerfCounters::kInstructions)) {
+    EXPECT_LT(1000000, PerfCounters::Get(PerfCounters::kChain,
+                                         PerfCounters::kInstructions));
+  } else {
+    EXPECT_EQ(0, PerfCounters::Get(PerfCounters::kChain,
+                                   PerfCounters::kInstructions));
+  }
+
+  EXPECT_LT(0., PerfCounters::Running());  // share of the enabled time
+  EXPECT_GE(1., PerfCounters::Running());
+
+  std::ostringstream os;
+  PerfCounters::Report(os);
+#ifndef RAM_PERF_COUNTERS
+  EXPECT_TRUE(os.str().empty());
+#endif
+
+  PerfCounters::Reset();
+  EXPECT_EQ(0, PerfCounters::Get(PerfCounters::kChain,
+                                 PerfCounters::kInstructions));
+  EXPECT_EQ(1., PerfCounters::Running());
+}
+
+}  // namespace test
+}  // namespace ram
@@ -0,0 +1,76 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "truth.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "gtest/gtest.h"
+
+namespace ram {
+namespace test {
+
+TEST(RamTruthTest, LoadTruth) {
+  auto path = ::testing::TempDir() + "ram_truth_test.paf";
+  {
+    std::ofstream os(path);
+    os << "r0\t1000\t0\t1000\t+\tt0\t5000\t100\t1100\t1000\t1000\t60\n"
+       << "r0\t1000\t0\t500\t-\tt1\t5000\t0\t500\t500\t500\t0\n"  // second
+       << "r1\t800\t0\t800\t-\tt1\t5000\t2000\t2800\t800\t800\t60\n"
+       << "malformed line\n";
+  }
+  auto truths = LoadTruth(path);
+  std::remove(path.c_str());
+
+  ASSERT_EQ(2, truths.size());
+  EXPECT_EQ("t0", truths["r0"].target);
+  EXPECT_EQ(100, truths["r0"].begin);
+  EXPECT_EQ(1100, truths["r0"].end);
+  EXPECT_TRUE(truths["r0"].strand);
+  EXPECT_EQ("t1", truths["r1"].target);
+  EXPECT_FALSE(truths["r1"].strand);
+
+  EXPECT_THROW(LoadTruth(path), std::invalid_argument);
+}
+
+TEST(RamTruthTest, Evaluate) {
+  std::vector<std::unique_ptr<biosoup::Sequence>> targets, sequences;
+  targets.emplace_back(new biosoup::Sequence(0, "t0", std::string(5000, 'A')));
+  targets.emplace_back(new biosoup::Sequence(1, "t1", std::string(5000, 'A')));
+  for (std::uint32_t i = 0; i < 5; ++i) {
+    sequences.emplace_back(new biosoup::Sequence(
+        i, "r" + std::to_string(i), std::string(1000, 'A')));
+  }
+
+  std::unordered_map<std::string, Truth> truths{
+      {"r0", Truth{"t0", 100, 1100, true}},
+      {"r1", Truth{"t1", 2000, 3000, false}},
+      {"r2", Truth{"t0", 0, 1000, true}},
+      {"r3", Truth{"t1", 0, 1000, true}}};
+
+  std::vector<std::vector<biosoup::Overlap>> overlaps(sequences.size());
+  overlaps[0] = {  // best one intersects the truth
+      biosoup::Overlap(0, 0, 1000, 1, 0, 1000, 10, true),
+      biosoup::Overlap(0, 0, 1000, 0, 900, 1900, 50, true)};
+  overlaps[1] = {  // right interval, wrong strand
+      biosoup::Overlap(1, 0, 1000, 1, 2000, 3000, 50, true)};
+  overlaps[3] = {  // right target and strand, disjoint interval
+      biosoup::Overlap(3, 0, 1000, 1, 1000, 2000, 50, true)};
+  overlaps[4] = {  // no truth
+      biosoup::Overlap(4, 0, 1000, 0, 0, 1000, 50, true)};
+
+  auto accuracy = Evaluate(targets, sequences, overlaps, truths);
+  EXPECT_EQ(4, accuracy.num_truths);
+  EXPECT_EQ(4, accuracy.num_mapped);
+  EXPECT_EQ(3, accuracy.num_mapped_truths);
+  EXPECT_EQ(1, accuracy.num_correct);
+  EXPECT_DOUBLE_EQ(0.25, accuracy.recall());
+  EXPECT_DOUBLE_EQ(1 / 3., accuracy.precision());
+
+  EXPECT_EQ(0., Evaluate(targets, sequences, overlaps, {}).recall());
+  EXPECT_EQ(0., Evaluate(targets, sequences, overlaps, {}).precision());
+}
+
+}  // namespace test
+}  // namespace ram